@@ -0,0 +1,138 @@
+// CPU亲和性/NUMA放置基准测试
+// 每个工作线程上运行若干条任务链, 每条链有自己的缓冲区(由第一次运行它的线程分配), 每一步遍历并改写缓冲区后投递下一步,
+// 分别在不绑定、绑定到CPU(setCpuAffinity)、按NUMA节点分布(setNumaSpread)三种方式下运行, 输出吞吐量和工作线程在CPU间迁移的次数
+// 用法: ./bench_affinity [工作线程数] [每条链的步数] [缓冲区KB]
+#include "ioscheduler.h"
+#include "numa.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+static size_t s_threads = std::thread::hardware_concurrency();
+static size_t s_steps = 2000;
+static size_t s_buffer_kb = 256;
+
+enum Mode
+{
+    UNPINNED = 0,
+    PINNED = 1,
+    NUMA_SPREAD = 2
+};
+
+// 工作线程上次运行所在的CPU
+static thread_local int t_last_cpu = -1;
+
+struct Chain
+{
+    std::vector<uint64_t> buffer;
+    size_t steps = 0;
+};
+
+static void bench(Mode mode)
+{
+    size_t chains = s_threads * 8;
+    std::atomic<size_t> remaining{chains};
+    std::atomic<uint64_t> migrations{0};
+    std::atomic<uint64_t> checksum{0};
+    corlib::Semaphore finished;
+    std::chrono::steady_clock::time_point begin, end;
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+        if (mode == PINNED)
+        {
+            // 所有CPU依次分给调用线程(下标0)和工作线程
+            std::vector<int> cpus;
+            for (int node : corlib::Numa::Nodes())
+            {
+                const std::vector<int> &node_cpus = corlib::Numa::NodeCpus(node);
+                cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+            }
+            iom.setCpuAffinity(cpus);
+        }
+        else if (mode == NUMA_SPREAD)
+        {
+            iom.setNumaSpread();
+        }
+
+        std::vector<Chain> state(chains);
+        std::function<void(size_t)> step;
+        step = [&](size_t index)
+        {
+            int cpu = sched_getcpu();
+            if (t_last_cpu != -1 && cpu != t_last_cpu)
+            {
+                migrations++;
+            }
+            t_last_cpu = cpu;
+
+            Chain &chain = state[index];
+            if (chain.buffer.empty())
+            {
+                chain.buffer.resize(s_buffer_kb * 1024 / sizeof(uint64_t));
+            }
+            uint64_t sum = 0;
+            for (uint64_t &x : chain.buffer)
+            {
+                sum += x;
+                x = sum;
+            }
+            if (++chain.steps < s_steps)
+            {
+                iom.scheduleLock(std::bind(step, index));
+                return;
+            }
+            checksum += sum;
+            if (--remaining == 0)
+            {
+                end = std::chrono::steady_clock::now();
+                finished.signal();
+            }
+        };
+
+        begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < chains; i++)
+        {
+            iom.scheduleLock(std::bind(step, i));
+        }
+        finished.wait();
+    }
+
+    static const char *names[] = {"unpinned", "cpu affinity", "numa spread"};
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    double gb = (double)chains * s_steps * s_buffer_kb / 1024 / 1024;
+    std::cout << std::setw(14) << names[mode]
+              << std::setw(12) << seconds * 1000
+              << std::setw(12) << gb / seconds
+              << std::setw(14) << migrations.load() << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_steps = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3)
+    {
+        s_buffer_kb = strtoul(argv[3], nullptr, 10);
+    }
+
+    std::cout << "threads: " << s_threads << ", numa nodes: " << corlib::Numa::Nodes().size()
+              << ", chains: " << s_threads * 8 << ", steps: " << s_steps << ", buffer: " << s_buffer_kb << " KB" << std::endl;
+    std::cout << std::setw(14) << "mode" << std::setw(12) << "ms" << std::setw(12) << "GB/s" << std::setw(14) << "migrations" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    bench(UNPINNED);
+    bench(PINNED);
+    bench(NUMA_SPREAD);
+    return 0;
+}
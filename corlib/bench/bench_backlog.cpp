@@ -0,0 +1,78 @@
+// 深积压队列的出队开销基准测试
+// 调用线程一次性向全局队列投递depth个任务(其中每pin_every个指定在同一个工作线程上运行), 然后等待全部执行完
+// 出队为O(1)时每个任务的耗时不随积压深度增长
+// 用法: ./bench_backlog [工作线程数] [最大深度] [pin_every, 0表示不指定线程]
+#include "ioscheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+static size_t s_threads = 4;
+static size_t s_pin_every = 8;
+
+static double bench(size_t depth)
+{
+    std::atomic<size_t> remaining{depth};
+    // 调用线程在stop()之后仍开启着hook -> 用条件变量而不是sleep等待
+    corlib::Semaphore finished;
+    std::chrono::steady_clock::time_point begin, end;
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+
+        // 找到一个工作线程作为指定线程的任务的目标
+        int target = 0;
+        corlib::Semaphore found;
+        iom.scheduleLock([&]()
+                         {
+            target = corlib::Thread::GetThreadId();
+            found.signal(); });
+        found.wait();
+
+        auto task = [&]()
+        {
+            if (--remaining == 0)
+            {
+                end = std::chrono::steady_clock::now();
+                finished.signal();
+            }
+        };
+
+        begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < depth; i++)
+        {
+            bool pin = s_pin_every && i % s_pin_every == 0;
+            iom.scheduleLock(task, pin ? target : -1);
+        }
+        finished.wait();
+    }
+    return std::chrono::duration<double, std::nano>(end - begin).count() / depth;
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_depth = 1000000;
+    if (argc > 1)
+    {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        max_depth = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3)
+    {
+        s_pin_every = strtoul(argv[3], nullptr, 10);
+    }
+
+    std::cout << "threads: " << s_threads << ", pinned: 1/" << s_pin_every << std::endl;
+    std::cout << std::setw(10) << "depth" << std::setw(14) << "ns/task" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t depth = 1000; depth <= max_depth; depth *= 10)
+    {
+        std::cout << std::setw(10) << depth << std::setw(14) << bench(depth) << std::endl;
+    }
+    return 0;
+}
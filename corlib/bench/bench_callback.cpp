@@ -0,0 +1,54 @@
+// 回调任务调度开销基准测试
+// 每个回调只把下一个回调投递到调度器(类似只调用scheduleLock的定时器回调), 在一个工作线程上串行执行,
+// 对比回调在调度协程上内联运行与在回调协程上运行时每个任务的耗时
+// 用法: ./bench_callback [任务数]
+#include "ioscheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+static size_t s_tasks = 1000000;
+
+static double bench(bool inline_callbacks)
+{
+    std::atomic<size_t> remaining{s_tasks};
+    // 调用线程在stop()之后仍开启着hook -> 用条件变量而不是sleep等待
+    corlib::Semaphore finished;
+    std::chrono::steady_clock::time_point begin, end;
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 任务在唯一的工作线程上执行
+        corlib::IOManager iom(2, true, "bench");
+        iom.setInlineCallbacks(inline_callbacks);
+
+        std::function<void()> step;
+        step = [&]()
+        {
+            if (--remaining == 0)
+            {
+                end = std::chrono::steady_clock::now();
+                finished.signal();
+                return;
+            }
+            iom.scheduleLock(step);
+        };
+
+        begin = std::chrono::steady_clock::now();
+        iom.scheduleLock(step);
+        finished.wait();
+    }
+    return std::chrono::duration<double, std::nano>(end - begin).count() / s_tasks;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_tasks = strtoul(argv[1], nullptr, 10);
+    }
+
+    std::cout << "tasks: " << s_tasks << std::endl;
+    std::cout << "callback fiber:   " << bench(false) << " ns/task" << std::endl;
+    std::cout << "inline callback:  " << bench(true) << " ns/task" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+// 协程上下文切换开销基准测试
+// 对比 Fiber::resume()/yield() (当前编译的后端) 与直接调用 swapcontext 的耗时,
+// 以及生产者/消费者两个协程交接数据时, 经过主协程中转与transferTo直接切换的耗时
+// 用法: ./bench_context_switch [切换轮数]
+#include "fiber.h"
+
+#include <ucontext.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+static const size_t kStackSize = 128 * 1024;
+
+static uint64_t s_rounds = 0;
+
+// swapcontext 对照组
+static ucontext_t s_main_uc;
+static ucontext_t s_child_uc;
+
+static void raw_child()
+{
+    while (true)
+    {
+        swapcontext(&s_child_uc, &s_main_uc);
+    }
+}
+
+static double bench_swapcontext(uint64_t rounds)
+{
+    char *stack = (char *)malloc(kStackSize);
+    getcontext(&s_child_uc);
+    s_child_uc.uc_link = nullptr;
+    s_child_uc.uc_stack.ss_sp = stack;
+    s_child_uc.uc_stack.ss_size = kStackSize;
+    makecontext(&s_child_uc, &raw_child, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        swapcontext(&s_main_uc, &s_child_uc);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    free(stack);
+    // 每轮两次切换
+    return std::chrono::duration<double, std::nano>(end - start).count() / (rounds * 2);
+}
+
+static double bench_fiber(uint64_t rounds)
+{
+    corlib::Fiber::GetThis();
+
+    uint64_t n = 0;
+    std::shared_ptr<corlib::Fiber> fiber = std::make_shared<corlib::Fiber>([&n]()
+    {
+        while (n < s_rounds)
+        {
+            n++;
+            corlib::Fiber::GetThis()->yield();
+        }
+    }, kStackSize, false);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        fiber->resume();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // 让协程正常结束
+    fiber->resume();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (rounds * 2);
+}
+
+// 生产者每产生一个数据就交给消费者, 返回每次交接的耗时
+static double bench_handoff(uint64_t rounds, bool direct)
+{
+    corlib::Fiber::GetThis();
+
+    uint64_t item = 0, sum = 0;
+    std::shared_ptr<corlib::Fiber> producer, consumer;
+    consumer = std::make_shared<corlib::Fiber>([&]()
+    {
+        for (uint64_t i = 0; i < rounds; i++)
+        {
+            sum += item;
+            if (direct)
+                consumer->transferTo(producer);
+            else
+                consumer->yield();
+        }
+    }, kStackSize, false);
+    producer = std::make_shared<corlib::Fiber>([&]()
+    {
+        for (uint64_t i = 0; i < rounds; i++)
+        {
+            item = i;
+            if (direct)
+                producer->transferTo(consumer);
+            else
+                producer->yield();
+        }
+    }, kStackSize, false);
+
+    auto start = std::chrono::steady_clock::now();
+    if (direct)
+    {
+        // 消费者最后一次交回后生产者结束, 返回主协程
+        producer->resume();
+    }
+    else
+    {
+        for (uint64_t i = 0; i < rounds; i++)
+        {
+            producer->resume();
+            consumer->resume();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // 让消费者正常结束
+    consumer->resume();
+    if (sum != rounds * (rounds - 1) / 2)
+    {
+        std::cerr << "handoff mismatch" << std::endl;
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    s_rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+
+    // 预热
+    bench_swapcontext(1000);
+
+    double raw = bench_swapcontext(s_rounds);
+    double fiber = bench_fiber(s_rounds);
+
+    std::cout << "rounds: " << s_rounds << std::endl;
+    std::cout << "swapcontext:                " << raw << " ns/switch" << std::endl;
+    std::cout << "Fiber (" << corlib::context_backend() << "): " << fiber << " ns/switch" << std::endl;
+    std::cout << "handoff via main fiber:     " << bench_handoff(s_rounds, false) << " ns/item" << std::endl;
+    std::cout << "handoff via transferTo:     " << bench_handoff(s_rounds, true) << " ns/item" << std::endl;
+    return 0;
+}
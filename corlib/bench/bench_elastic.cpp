@@ -0,0 +1,110 @@
+// 弹性线程池基准测试
+// 分别使用固定的少量线程、固定的大量线程和在两者之间伸缩的弹性线程池:
+// 先测创建调度器的耗时, 再投递一批会阻塞线程的任务(不经过hook的nanosleep, 相当于fsync等无法异步化的调用)测完成时间,
+// 最后空闲一段时间, 输出各阶段的线程数和伸缩次数
+// 用法: ./bench_elastic [最少线程数] [最多线程数] [阻塞任务数] [每个任务阻塞ms]
+#include "ioscheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+static size_t s_min_threads = 2;
+static size_t s_max_threads = 32;
+static size_t s_tasks = 256;
+static long s_block_ms = 10;
+
+enum Mode
+{
+    FIXED_MIN = 0,
+    FIXED_MAX = 1,
+    ELASTIC = 2
+};
+
+static void block()
+{
+    // 直接使用系统调用 -> 不被hook转换为定时器
+    struct timespec ts = {s_block_ms / 1000, (s_block_ms % 1000) * 1000000};
+    syscall(SYS_nanosleep, &ts, nullptr);
+}
+
+static void bench(Mode mode)
+{
+    double ctor_ms = 0, burst_ms = 0;
+    corlib::Scheduler::WorkerPoolStats busy, idle;
+    // 调用线程在stop()之后仍开启着hook -> 在独立的线程上运行
+    std::thread runner([&]()
+                       {
+        auto begin = std::chrono::steady_clock::now();
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        size_t threads = (mode == FIXED_MIN ? s_min_threads : s_max_threads) + 1;
+        corlib::IOManager iom(threads, true, "bench", mode == ELASTIC ? s_min_threads + 1 : 0);
+        ctor_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        iom.setElasticOptions(5, 500);
+
+        std::atomic<size_t> remaining{s_tasks};
+        corlib::Semaphore finished;
+        begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < s_tasks; i++)
+        {
+            iom.scheduleLock([&]()
+                             {
+                block();
+                if (--remaining == 0)
+                {
+                    finished.signal();
+                } });
+        }
+        finished.wait();
+        burst_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        busy = iom.getWorkerPoolStats();
+
+        usleep(1500000);
+        idle = iom.getWorkerPoolStats(); });
+    runner.join();
+
+    static const char *names[] = {"fixed min", "fixed max", "elastic"};
+    std::cout << std::setw(10) << names[mode]
+              << std::setw(10) << ctor_ms
+              << std::setw(10) << burst_ms
+              << std::setw(14) << busy.threads
+              << std::setw(14) << idle.threads
+              << std::setw(8) << idle.grown
+              << std::setw(8) << idle.retired << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_min_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_max_threads = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3)
+    {
+        s_tasks = strtoul(argv[3], nullptr, 10);
+    }
+    if (argc > 4)
+    {
+        s_block_ms = strtol(argv[4], nullptr, 10);
+    }
+
+    std::cout << "threads: " << s_min_threads << "-" << s_max_threads << ", blocking tasks: " << s_tasks
+              << ", block: " << s_block_ms << " ms" << std::endl;
+    std::cout << std::setw(10) << "pool" << std::setw(10) << "ctor ms" << std::setw(10) << "burst ms"
+              << std::setw(14) << "busy threads" << std::setw(14) << "idle threads"
+              << std::setw(8) << "grown" << std::setw(8) << "retired" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    bench(FIXED_MIN);
+    bench(FIXED_MAX);
+    bench(ELASTIC);
+    return 0;
+}
@@ -0,0 +1,220 @@
+// 阻塞任务卸载基准测试
+// 若干个协程反复执行阻塞调用(不经过hook的nanosleep, 相当于fsync/getaddrinfo), 同时外部线程每隔1ms投递一个短任务,
+// 分别在工作线程上直接阻塞和通过offload()交给阻塞任务线程池两种方式下运行,
+// 输出总耗时、短任务的排队延迟分位数, 以及线程池的最大排队数和排队延迟;
+// 最后在所有协程都还挂起等待线程池时立即关闭调度器, 检查关闭是否等到了它们全部恢复;
+// 以及线程池排队数有上限时, 超出的offload()是否立即以EAGAIN失败
+// 用法: ./bench_offload [工作线程数] [阻塞协程数] [每个协程的调用次数] [每次阻塞ms] [线程池线程数]
+#include "cancel.h"
+#include "ioscheduler.h"
+#include "offload.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sys/syscall.h>
+#include <system_error>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static size_t s_threads = 2;
+static size_t s_fibers = 16;
+static size_t s_calls = 20;
+static long s_block_ms = 2;
+static size_t s_pool_threads = 8;
+
+enum Mode
+{
+    DIRECT = 0,
+    OFFLOAD = 1
+};
+
+static void block()
+{
+    // 直接使用系统调用 -> 不被hook转换为定时器
+    struct timespec ts = {s_block_ms / 1000, (s_block_ms % 1000) * 1000000};
+    syscall(SYS_nanosleep, &ts, nullptr);
+}
+
+static void bench(Mode mode)
+{
+    corlib::OffloadPool pool(s_pool_threads, "bench_offload");
+    std::vector<double> latencies;
+    double total_ms = 0;
+    // 调用线程在stop()之后仍开启着hook -> 在独立的线程上运行
+    std::thread runner([&]()
+                       {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+        std::atomic<size_t> remaining{s_fibers};
+        std::atomic<bool> done{false};
+        corlib::Semaphore finished;
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < s_fibers; i++)
+        {
+            iom.scheduleLock([&]()
+                             {
+                for (size_t j = 0; j < s_calls; j++)
+                {
+                    if (mode == OFFLOAD)
+                    {
+                        corlib::offload(&pool, block);
+                    }
+                    else
+                    {
+                        block();
+                    }
+                }
+                if (--remaining == 0)
+                {
+                    total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                    done = true;
+                    finished.signal();
+                } });
+        }
+
+        // 阻塞协程运行期间的短任务
+        std::atomic<size_t> probes{0};
+        std::vector<double> samples;
+        std::mutex mutex;
+        while (!done)
+        {
+            auto submit = std::chrono::steady_clock::now();
+            probes++;
+            iom.scheduleLock([&, submit]()
+                             {
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submit).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                samples.push_back(ms);
+                probes--; });
+            usleep(1000);
+        }
+        finished.wait();
+        while (probes > 0)
+        {
+            usleep(1000);
+        }
+        latencies.swap(samples); });
+    runner.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    corlib::OffloadPool::Stats stats = pool.getStats();
+    static const char *names[] = {"direct", "offload"};
+    std::cout << std::setw(10) << names[mode]
+              << std::setw(10) << total_ms
+              << std::setw(12) << (latencies.empty() ? 0 : latencies[latencies.size() / 2])
+              << std::setw(12) << (latencies.empty() ? 0 : latencies[latencies.size() * 99 / 100])
+              << std::setw(12) << stats.max_queued
+              << std::setw(14) << stats.queue_delay.p99_ns / 1e6 << std::endl;
+}
+
+// 协程挂起在offload()中时关闭调度器 -> 析构函数应等待它们恢复并运行结束, 而不是丢弃它们
+static void benchShutdown()
+{
+    corlib::OffloadPool pool(s_pool_threads, "bench_offload");
+    std::atomic<size_t> completed{0}, timedout{0};
+    double stop_ms = 0;
+    std::thread runner([&]()
+                       {
+        std::chrono::steady_clock::time_point begin;
+        {
+            corlib::IOManager iom(s_threads + 1, true, "bench");
+            for (size_t i = 0; i < s_fibers; i++)
+            {
+                iom.scheduleLock([&, i]()
+                                 {
+                    // 一半的协程设置比阻塞调用短的截止时间 -> 由定时器唤醒
+                    if (i % 2)
+                    {
+                        corlib::CancelContext::SetTimeout(s_block_ms / 2);
+                    }
+                    try
+                    {
+                        corlib::offload(&pool, block);
+                        completed++;
+                    }
+                    catch (const std::system_error &)
+                    {
+                        timedout++;
+                    } });
+            }
+            begin = std::chrono::steady_clock::now();
+        }
+        stop_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count(); });
+    runner.join();
+
+    std::cout << "shutdown while offloading: " << completed + timedout << "/" << s_fibers << " fibers resumed ("
+              << completed << " completed, " << timedout << " timed out), stop took " << stop_ms << " ms" << std::endl;
+}
+
+// 线程池最多排队s_pool_threads个任务 -> 所有协程同时offload时超出的部分应立即失败, 排队数不超过上限
+static void benchOverload()
+{
+    corlib::OffloadPool pool(s_pool_threads, "bench_offload", s_pool_threads);
+    std::atomic<size_t> completed{0}, rejected{0};
+    std::thread runner([&]()
+                       {
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+        for (size_t i = 0; i < s_fibers * 4; i++)
+        {
+            iom.scheduleLock([&]()
+                             {
+                try
+                {
+                    corlib::offload(&pool, block);
+                    completed++;
+                }
+                catch (const std::system_error &e)
+                {
+                    if (e.code().value() == EAGAIN)
+                    {
+                        rejected++;
+                    }
+                } });
+        } });
+    runner.join();
+
+    corlib::OffloadPool::Stats stats = pool.getStats();
+    std::cout << "bounded queue (" << pool.getMaxQueueDepth() << "): " << completed << " completed, " << rejected
+              << " rejected (stats " << stats.rejected << "), max queued " << stats.max_queued << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_fibers = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3)
+    {
+        s_calls = strtoul(argv[3], nullptr, 10);
+    }
+    if (argc > 4)
+    {
+        s_block_ms = strtol(argv[4], nullptr, 10);
+    }
+    if (argc > 5)
+    {
+        s_pool_threads = strtoul(argv[5], nullptr, 10);
+    }
+
+    std::cout << "threads: " << s_threads << ", blocking fibers: " << s_fibers << " x " << s_calls << " calls of "
+              << s_block_ms << " ms, pool threads: " << s_pool_threads << std::endl;
+    std::cout << std::setw(10) << "mode" << std::setw(10) << "total ms" << std::setw(12) << "probe p50"
+              << std::setw(12) << "probe p99" << std::setw(12) << "max queued" << std::setw(14) << "pool wait p99" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    bench(DIRECT);
+    bench(OFFLOAD);
+    benchShutdown();
+    benchOverload();
+    return 0;
+}
@@ -0,0 +1,138 @@
+// 优先级队列基准测试
+// 大量普通优先级的批量任务(每个计算约20us后重新投递自己)占满工作线程, 另一个线程每隔200us投递一个探测任务,
+// 分别以普通和高优先级投递探测任务, 对比探测任务的排队延迟, 并输出调度器统计的各优先级排队延迟
+// 用法: ./bench_priority [工作线程数] [探测次数]
+#include "ioscheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static size_t s_threads = 2;
+static size_t s_probes = 2000;
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void spin(uint64_t ns)
+{
+    uint64_t end = now_ns() + ns;
+    while (now_ns() < end)
+    {
+    }
+}
+
+static void print(const char *name, const corlib::Scheduler::QueueDelayStats &stats)
+{
+    std::cout << "  " << std::left << std::setw(16) << name << std::right
+              << " count " << std::setw(8) << stats.count
+              << "  p50 " << std::setw(9) << stats.p50_ns / 1000.0 << " us"
+              << "  p99 " << std::setw(9) << stats.p99_ns / 1000.0 << " us"
+              << "  max " << std::setw(9) << stats.max_ns / 1000.0 << " us" << std::endl;
+}
+
+static void bench(corlib::Scheduler::Priority priority)
+{
+    std::vector<uint64_t> delays;
+    std::mutex mutex;
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> bulk_running{0};
+    corlib::Semaphore finished;
+    corlib::Scheduler::QueueDelayStats lanes[corlib::Scheduler::PRIORITY_COUNT];
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+        iom.setQueueDelayMetrics(true);
+
+        // 批量任务: 保持队列中始终有积压
+        std::function<void()> bulk;
+        bulk = [&]()
+        {
+            spin(20000);
+            if (stop)
+            {
+                if (--bulk_running == 0)
+                {
+                    finished.signal();
+                }
+                return;
+            }
+            iom.scheduleLock(bulk);
+        };
+        size_t bulk_tasks = s_threads * 64;
+        bulk_running = bulk_tasks;
+        for (size_t i = 0; i < bulk_tasks; i++)
+        {
+            iom.scheduleLock(bulk);
+        }
+
+        // 探测任务在普通线程上投递(不开启hook)
+        std::thread prober([&]()
+                           {
+            for (size_t i = 0; i < s_probes; i++)
+            {
+                uint64_t start = now_ns();
+                iom.scheduleLock([&, start]()
+                                 {
+                    uint64_t delay = now_ns() - start;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    delays.push_back(delay); },
+                                 -1, priority);
+                usleep(200);
+            } });
+        prober.join();
+
+        // 等待最后的探测任务执行完
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (delays.size() == s_probes)
+                {
+                    break;
+                }
+            }
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < corlib::Scheduler::PRIORITY_COUNT; i++)
+        {
+            lanes[i] = iom.getQueueDelay((corlib::Scheduler::Priority)i);
+        }
+        stop = true;
+        finished.wait();
+    }
+
+    std::sort(delays.begin(), delays.end());
+    std::cout << (priority == corlib::Scheduler::PRIORITY_HIGH ? "probe as HIGH" : "probe as NORMAL")
+              << ": p50 " << delays[delays.size() / 2] / 1000.0 << " us"
+              << ", p99 " << delays[delays.size() * 99 / 100] / 1000.0 << " us"
+              << ", max " << delays.back() / 1000.0 << " us" << std::endl;
+    print("lane NORMAL", lanes[corlib::Scheduler::PRIORITY_NORMAL]);
+    print("lane HIGH", lanes[corlib::Scheduler::PRIORITY_HIGH]);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_probes = strtoul(argv[2], nullptr, 10);
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "threads: " << s_threads << ", bulk tasks: " << s_threads * 64 << ", probes: " << s_probes << std::endl;
+    bench(corlib::Scheduler::PRIORITY_NORMAL);
+    bench(corlib::Scheduler::PRIORITY_HIGH);
+    return 0;
+}
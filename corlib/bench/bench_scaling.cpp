@@ -0,0 +1,104 @@
+// 调度器线程扩展性基准测试
+// spawn:  从一个任务开始, 每个任务做少量计算后派生两个子任务(二叉树), 任务由工作线程投递 -> 本地队列和窃取
+// inject: 调用线程从外部一次性投递所有任务 -> 全局队列
+// 工作线程数从1增加到N, 输出每秒完成的任务数
+// 用法: ./bench_scaling [最大线程数] [树深度]
+#include "ioscheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+static size_t s_depth = 18;
+
+// 模拟任务本身的少量计算
+static void work()
+{
+    volatile uint64_t x = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        x = x + i;
+    }
+}
+
+static double bench(size_t threads, bool inject)
+{
+    size_t total = (1ul << (s_depth + 1)) - 1;
+    std::atomic<size_t> remaining{total};
+    // 调用线程在stop()之后仍开启着hook -> 用条件变量而不是sleep等待
+    corlib::Semaphore finished;
+    std::chrono::steady_clock::time_point begin, end;
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程, 使工作线程数为threads
+        corlib::IOManager iom(threads + 1, true, "bench");
+
+        auto finish = [&]()
+        {
+            if (--remaining == 0)
+            {
+                end = std::chrono::steady_clock::now();
+                finished.signal();
+            }
+        };
+
+        std::function<void(size_t)> spawn;
+        spawn = [&](size_t depth)
+        {
+            work();
+            if (depth < s_depth)
+            {
+                iom.scheduleLock(std::bind(spawn, depth + 1));
+                iom.scheduleLock(std::bind(spawn, depth + 1));
+            }
+            finish();
+        };
+
+        begin = std::chrono::steady_clock::now();
+        if (inject)
+        {
+            for (size_t i = 0; i < total; i++)
+            {
+                iom.scheduleLock([&]()
+                                 {
+                    work();
+                    finish(); });
+            }
+        }
+        else
+        {
+            iom.scheduleLock(std::bind(spawn, 0));
+        }
+        finished.wait();
+    }
+    return total / std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_threads = std::thread::hardware_concurrency();
+    if (argc > 1)
+    {
+        max_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_depth = strtoul(argv[2], nullptr, 10);
+    }
+
+    std::cout << "tasks: " << (1ul << (s_depth + 1)) - 1 << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "spawn(Mtask/s)" << std::setw(16) << "inject(Mtask/s)" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double spawn = bench(threads, false) / 1e6;
+        double inject = bench(threads, true) / 1e6;
+        std::cout << std::setw(8) << threads << std::setw(16) << spawn << std::setw(16) << inject << std::endl;
+        if (threads < max_threads && threads * 2 > max_threads)
+        {
+            threads = max_threads / 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,217 @@
+// 协程栈内存占用/切换开销基准测试
+// 每个协程先使用touch_kb的栈处理"请求", 返回后在浅层挂起等待"下一个请求"(类似长连接),
+// 统计所有协程挂起时每个协程的常驻内存(RSS), 以及轮流恢复所有协程时一次切换的耗时
+// task模式使用无栈的corlib::Task作对比: 挂起时只剩协程帧
+// reclaim模式在mmap模式的基础上对挂起的协程调用Fiber::reclaimStack, 统计释放栈顶以下的页之后的RSS
+// 用法: ./bench_stack_memory [协程数] [每个协程使用的栈KB] [栈大小KB] [共享栈个数]
+#include "fiber.h"
+#include "task.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static size_t s_fibers = 10000;
+static size_t s_touch_kb = 8;
+static size_t s_stack_kb = 128;
+static size_t s_shared_count = 4;
+
+// 当前进程的常驻内存(KB)
+static size_t rss_kb()
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+    {
+        return 0;
+    }
+    size_t size = 0, resident = 0;
+    if (fscanf(fp, "%zu %zu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 使用kb的栈空间
+static void __attribute__((noinline)) use_stack(size_t kb)
+{
+    volatile char buf[1024];
+    memset((char *)buf, 1, sizeof(buf));
+    if (kb > 1)
+    {
+        use_stack(kb - 1);
+    }
+    buf[0] = 0;
+}
+
+// 处理一次请求后在浅层挂起, 被恢复两次后结束
+static void connection()
+{
+    use_stack(s_touch_kb);
+    corlib::Fiber::GetThis()->yield();
+    corlib::Fiber::GetThis()->yield();
+}
+
+static std::shared_ptr<corlib::Fiber> make_fiber(const char *name, corlib::SharedStackPool *pool)
+{
+    if (pool)
+    {
+        return std::make_shared<corlib::Fiber>(&connection, pool->next(), false);
+    }
+    corlib::StackAllocator::Mode mode = strcmp(name, "malloc") == 0 ? corlib::StackAllocator::MALLOC : corlib::StackAllocator::MMAP;
+    return std::make_shared<corlib::Fiber>(&connection, s_stack_kb * 1024, false, mode);
+}
+
+// 把挂起的协程句柄存到slot, 由基准测试循环恢复
+struct Park
+{
+    std::coroutine_handle<> *slot;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { *slot = handle; }
+    void await_resume() const noexcept {}
+};
+
+static corlib::Task<> connection_task(std::coroutine_handle<> *slot)
+{
+    use_stack(s_touch_kb);
+    co_await Park{slot};
+    co_await Park{slot};
+}
+
+// 立即开始执行并在结束时自动释放的外壳, 与co_spawn的开销相同
+struct Starter
+{
+    struct promise_type
+    {
+        Starter get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static Starter start_task(std::coroutine_handle<> *slot)
+{
+    co_await connection_task(slot);
+}
+
+static void run_tasks()
+{
+    size_t before = rss_kb();
+    std::vector<std::coroutine_handle<>> tasks(s_fibers);
+    for (size_t i = 0; i < s_fibers; i++)
+    {
+        start_task(&tasks[i]);
+    }
+    size_t after = rss_kb();
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &task : tasks)
+    {
+        task.resume();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (auto &task : tasks)
+    {
+        task.resume();
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-8s tasks=%zu touched=%zuKB rss=%zuKB (%.2f KB/task) resume+suspend=%.0f ns\n",
+           "task", s_fibers, s_touch_kb, after - before, (double)(after - before) / s_fibers, ns / s_fibers);
+}
+
+static void run(const char *name)
+{
+    if (strcmp(name, "task") == 0)
+    {
+        run_tasks();
+        return;
+    }
+
+    corlib::Fiber::GetThis();
+
+    std::unique_ptr<corlib::SharedStackPool> pool;
+    if (strcmp(name, "shared") == 0)
+    {
+        pool.reset(new corlib::SharedStackPool(s_shared_count, s_stack_kb * 1024));
+    }
+
+    size_t before = rss_kb();
+    std::vector<std::shared_ptr<corlib::Fiber>> fibers;
+    fibers.reserve(s_fibers);
+    for (size_t i = 0; i < s_fibers; i++)
+    {
+        fibers.push_back(make_fiber(name, pool.get()));
+        fibers.back()->resume();
+    }
+    size_t after = rss_kb();
+
+    if (strcmp(name, "reclaim") == 0)
+    {
+        bool woken;
+        for (auto &fiber : fibers)
+        {
+            fiber->reclaimStack(&woken);
+        }
+        after = rss_kb();
+    }
+
+    // 轮流恢复每个协程一次 -> 共享栈模式下每次切换都需要换出/换入栈
+    auto start = std::chrono::steady_clock::now();
+    for (auto &fiber : fibers)
+    {
+        fiber->resume();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (auto &fiber : fibers)
+    {
+        fiber->resume();
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-8s fibers=%zu stack=%zuKB touched=%zuKB rss=%zuKB (%.2f KB/fiber) resume+yield=%.0f ns\n",
+           name, s_fibers, s_stack_kb, s_touch_kb, after - before, (double)(after - before) / s_fibers, ns / s_fibers);
+}
+
+// 在子进程中运行, 互不影响RSS
+static void run_in_child(const char *name)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        run(name);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        s_fibers = strtoull(argv[1], nullptr, 10);
+    if (argc > 2)
+        s_touch_kb = strtoull(argv[2], nullptr, 10);
+    if (argc > 3)
+        s_stack_kb = strtoull(argv[3], nullptr, 10);
+    if (argc > 4)
+        s_shared_count = strtoull(argv[4], nullptr, 10);
+
+    run_in_child("malloc");
+    run_in_child("mmap");
+    run_in_child("shared");
+    run_in_child("reclaim");
+    run_in_child("task");
+    return 0;
+}
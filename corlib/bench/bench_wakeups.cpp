@@ -0,0 +1,125 @@
+// 唤醒次数基准测试
+// burst:  外部线程一次投递一批任务, 等这批执行完再投递下一批
+// trickle: 外部线程每隔50us投递一个任务(低负载, 每个任务都可能需要唤醒)
+// fanout: 一个任务在工作线程上一次派生一批子任务(每次投递都会tickle)
+// 输出每个任务平均唤醒空闲线程的次数, 以及进程的主动上下文切换次数(线程睡眠/醒来的代价)
+// 用法: ./bench_wakeups [工作线程数] [任务数]
+#include "ioscheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+
+static size_t s_threads = 4;
+static size_t s_tasks = 100000;
+
+static long voluntary_switches()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw;
+}
+
+enum Workload
+{
+    BURST = 0,
+    TRICKLE = 1,
+    FANOUT = 2
+};
+
+static void bench(Workload workload)
+{
+    static const size_t kBatch = 64;
+    size_t tasks = workload == TRICKLE ? s_tasks / 20 : s_tasks;
+    uint64_t wakeups = 0;
+    long switches = 0;
+    std::chrono::steady_clock::time_point begin, end;
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+
+        // 信号量在批次之间复用 -> signal()返回之前等待方不会销毁它
+        std::atomic<size_t> remaining{0};
+        corlib::Semaphore finished;
+        auto task = [&]()
+        {
+            if (--remaining == 0)
+            {
+                finished.signal();
+            }
+        };
+        // 调用线程在stop()之后仍开启着hook -> 在独立的线程上sleep和投递
+        std::thread submitter([&]()
+                              {
+            // 等工作线程都进入空闲状态
+            usleep(100000);
+            uint64_t wakeups_before = iom.getWakeupCount();
+            long switches_before = voluntary_switches();
+            begin = std::chrono::steady_clock::now();
+
+            for (size_t done = 0; done < tasks;)
+            {
+                size_t batch = workload == TRICKLE ? 1 : std::min(kBatch, tasks - done);
+                remaining = batch;
+                if (workload == FANOUT)
+                {
+                    iom.scheduleLock([&]()
+                                     {
+                        for (size_t i = 0; i < batch; i++)
+                        {
+                            iom.scheduleLock(task);
+                        } });
+                }
+                else
+                {
+                    for (size_t i = 0; i < batch; i++)
+                    {
+                        iom.scheduleLock(task);
+                    }
+                }
+                finished.wait();
+                done += batch;
+                if (workload == TRICKLE)
+                {
+                    usleep(50);
+                }
+            }
+
+            end = std::chrono::steady_clock::now();
+            wakeups = iom.getWakeupCount() - wakeups_before;
+            switches = voluntary_switches() - switches_before; });
+        submitter.join();
+    }
+
+    static const char *names[] = {"burst", "trickle", "fanout"};
+    std::cout << std::setw(10) << names[workload]
+              << std::setw(10) << tasks
+              << std::setw(14) << (double)wakeups / tasks
+              << std::setw(16) << (double)switches / tasks
+              << std::setw(12) << std::chrono::duration<double, std::milli>(end - begin).count() << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_tasks = strtoul(argv[2], nullptr, 10);
+    }
+
+    std::cout << "threads: " << s_threads << std::endl;
+    std::cout << std::setw(10) << "workload" << std::setw(10) << "tasks" << std::setw(14) << "wakeups/task"
+              << std::setw(16) << "ctx switch/task" << std::setw(12) << "ms" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    bench(BURST);
+    bench(TRICKLE);
+    bench(FANOUT);
+    return 0;
+}
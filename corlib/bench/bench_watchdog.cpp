@@ -0,0 +1,117 @@
+// 看门狗基准测试
+// 每个工作线程上都有一个长时间占用CPU的任务(每隔一段计算经过一次安全点PreemptPoint, 相当于夹杂着hook的I/O),
+// 同时外部线程每隔1ms投递一个短任务, 分别在关闭看门狗、只报告、报告并要求让出三种方式下运行, 输出短任务的排队延迟分位数
+// 用法: ./bench_watchdog [工作线程数] [短任务数] [时间片ms]
+#include "ioscheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static size_t s_threads = 2;
+static size_t s_tasks = 500;
+static uint64_t s_slice_ms = 10;
+
+enum Mode
+{
+    OFF = 0,
+    REPORT = 1,
+    PREEMPT = 2
+};
+
+static void bench(Mode mode)
+{
+    std::vector<double> latencies(s_tasks);
+    uint64_t overruns = 0;
+    {
+        // 使用调用线程时它只在stop()中参与调度 -> 额外创建一个线程
+        corlib::IOManager iom(s_threads + 1, true, "bench");
+        iom.setOverrunHandler([](const corlib::Scheduler::OverrunReport &) {});
+        if (mode != OFF)
+        {
+            iom.setWatchdog(s_slice_ms, mode == PREEMPT);
+        }
+
+        std::atomic<bool> done{false};
+        std::atomic<size_t> remaining{s_tasks + s_threads};
+        corlib::Semaphore finished;
+        for (size_t i = 0; i < s_threads; i++)
+        {
+            iom.scheduleLock([&]()
+                             {
+                while (!done)
+                {
+                    // 约几十微秒的计算
+                    volatile uint64_t x = 0;
+                    for (int j = 0; j < 20000; j++)
+                    {
+                        x = x + j;
+                    }
+                    corlib::Scheduler::PreemptPoint();
+                }
+                if (--remaining == 0)
+                {
+                    finished.signal();
+                } });
+        }
+
+        // 调用线程在stop()之后仍开启着hook -> 在独立的线程上sleep和投递
+        std::thread submitter([&]()
+                              {
+            for (size_t i = 0; i < s_tasks; i++)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                iom.scheduleLock([&, i, begin]()
+                                 {
+                    latencies[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                    if (--remaining == 0)
+                    {
+                        finished.signal();
+                    } });
+                usleep(1000);
+            }
+            // 关闭看门狗时短任务要等占用CPU的任务结束才能运行 -> 投递完就结束它们
+            done = true;
+            finished.wait(); });
+        submitter.join();
+        overruns = iom.getOverrunCount();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    static const char *names[] = {"off", "report", "preempt"};
+    std::cout << std::setw(10) << names[mode]
+              << std::setw(12) << latencies[latencies.size() / 2]
+              << std::setw(12) << latencies[latencies.size() * 99 / 100]
+              << std::setw(12) << latencies.back()
+              << std::setw(12) << overruns << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2)
+    {
+        s_tasks = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3)
+    {
+        s_slice_ms = strtoul(argv[3], nullptr, 10);
+    }
+
+    std::cout << "threads: " << s_threads << ", short tasks: " << s_tasks << ", slice: " << s_slice_ms << " ms" << std::endl;
+    std::cout << std::setw(10) << "watchdog" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms"
+              << std::setw(12) << "max ms" << std::setw(12) << "overruns" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    bench(OFF);
+    bench(REPORT);
+    bench(PREEMPT);
+    return 0;
+}
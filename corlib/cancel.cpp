@@ -0,0 +1,216 @@
+#include "cancel.h"
+#include "ioscheduler.h"
+
+#include <errno.h>
+#include <time.h>
+#include <vector>
+
+namespace corlib
+{
+
+	// 协程局部的截止时间和取消令牌
+	struct CancelContextData
+	{
+		uint64_t deadline = ~0ull;
+		CancelToken::ptr token;
+	};
+
+	static FiberLocal<CancelContextData> s_cancel_context;
+
+	struct CancelWaitState
+	{
+		std::mutex mutex;
+		// finish()之后不再唤醒
+		bool done = false;
+		int error = 0;
+		std::function<bool()> wake;
+		std::shared_ptr<Timer> timer;
+		CancelToken::ptr token;
+		std::list<std::shared_ptr<CancelWaitState>>::iterator token_it;
+
+		void trigger(int err)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (done || error)
+			{
+				return;
+			}
+			// 正常唤醒已经先一步发生 -> 不算超时/取消
+			if (wake())
+			{
+				error = err;
+			}
+		}
+	};
+
+	uint64_t CancelContext::NowMS()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+	}
+
+	void CancelContext::SetTimeout(uint64_t ms)
+	{
+		SetDeadline(ms == ~0ull ? ~0ull : NowMS() + ms);
+	}
+
+	void CancelContext::SetDeadline(uint64_t deadline_ms)
+	{
+		s_cancel_context->deadline = deadline_ms;
+	}
+
+	uint64_t CancelContext::GetDeadline()
+	{
+		CancelContextData *data = s_cancel_context.peek();
+		return data ? data->deadline : ~0ull;
+	}
+
+	uint64_t CancelContext::GetRemaining()
+	{
+		uint64_t deadline = GetDeadline();
+		if (deadline == ~0ull)
+		{
+			return ~0ull;
+		}
+		uint64_t now = NowMS();
+		return deadline > now ? deadline - now : 0;
+	}
+
+	void CancelContext::SetToken(CancelToken::ptr token)
+	{
+		s_cancel_context->token = token;
+	}
+
+	CancelToken::ptr CancelContext::GetToken()
+	{
+		CancelContextData *data = s_cancel_context.peek();
+		return data ? data->token : nullptr;
+	}
+
+	int CancelContext::Check()
+	{
+		CancelContextData *data = s_cancel_context.peek();
+		if (!data)
+		{
+			return 0;
+		}
+		if (data->token && data->token->isCancelled())
+		{
+			return ECANCELED;
+		}
+		if (data->deadline != ~0ull && NowMS() >= data->deadline)
+		{
+			return ETIMEDOUT;
+		}
+		return 0;
+	}
+
+	bool CancelContext::IsActive()
+	{
+		CancelContextData *data = s_cancel_context.peek();
+		return data && (data->token || data->deadline != ~0ull);
+	}
+
+	void CancelToken::cancel()
+	{
+		std::vector<std::shared_ptr<CancelWaitState>> waits;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_cancelled)
+			{
+				return;
+			}
+			m_cancelled = true;
+			waits.assign(m_waits.begin(), m_waits.end());
+		}
+		for (auto &state : waits)
+		{
+			state->trigger(ECANCELED);
+		}
+	}
+
+	CancelWait::CancelWait(std::function<bool()> wake)
+	{
+		CancelContextData *data = s_cancel_context.peek();
+		if (!data || (!data->token && data->deadline == ~0ull))
+		{
+			return;
+		}
+
+		m_state = std::make_shared<CancelWaitState>();
+		m_state->wake = std::move(wake);
+
+		if (data->token)
+		{
+			bool cancelled;
+			{
+				std::lock_guard<std::mutex> lock(data->token->m_mutex);
+				cancelled = data->token->m_cancelled;
+				if (!cancelled)
+				{
+					m_state->token = data->token;
+					m_state->token_it = data->token->m_waits.insert(data->token->m_waits.end(), m_state);
+				}
+			}
+			if (cancelled)
+			{
+				m_state->trigger(ECANCELED);
+				return;
+			}
+		}
+
+		if (data->deadline != ~0ull)
+		{
+			// 截止时间由当前线程IOManager的定时器负责; 没有IOManager时只在挂起前检查
+			IOManager *iom = IOManager::GetThis();
+			if (iom)
+			{
+				std::weak_ptr<CancelWaitState> weak(m_state);
+				uint64_t now = CancelContext::NowMS();
+				uint64_t timeout = data->deadline > now ? data->deadline - now : 0;
+				m_state->timer = iom->addConditionTimer(timeout, [weak]()
+														{
+					auto state = weak.lock();
+					if (state)
+					{
+						state->trigger(ETIMEDOUT);
+					} }, weak);
+			}
+		}
+	}
+
+	CancelWait::~CancelWait()
+	{
+		finish();
+	}
+
+	int CancelWait::finish()
+	{
+		if (!m_state)
+		{
+			return 0;
+		}
+
+		std::shared_ptr<CancelWaitState> state;
+		state.swap(m_state);
+
+		int error;
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->done = true;
+			error = state->error;
+		}
+		if (state->timer)
+		{
+			state->timer->cancel();
+		}
+		if (state->token)
+		{
+			std::lock_guard<std::mutex> lock(state->token->m_mutex);
+			state->token->m_waits.erase(state->token_it);
+		}
+		return error;
+	}
+
+} // namespace corlib
@@ -0,0 +1,79 @@
+#ifndef _CANCEL_H_
+#define _CANCEL_H_
+
+#include "fiber.h"
+
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace corlib
+{
+
+	struct CancelWaitState;
+
+	// 取消令牌 -> 可以被多个协程共享, cancel()之后所有关联的协程在挂起点返回ECANCELED
+	class CancelToken
+	{
+		friend class CancelWait;
+	public:
+		typedef std::shared_ptr<CancelToken> ptr;
+
+		// 取消并唤醒正在挂起等待的关联协程, 可以在任意线程调用
+		void cancel();
+		bool isCancelled() const { return m_cancelled.load(std::memory_order_acquire); }
+
+	private:
+		std::mutex m_mutex;
+		std::atomic<bool> m_cancelled = {false};
+		// 正在挂起等待的协程
+		std::list<std::shared_ptr<CancelWaitState>> m_waits;
+	};
+
+	// 当前协程的截止时间和取消令牌
+	// 随协程任务结束而清除; 被hook的I/O、connect、sleep系列和FiberSemaphore::wait在挂起前后检查,
+	// 超过截止时间返回ETIMEDOUT, 令牌被取消返回ECANCELED; 计算密集的代码可以主动调用Check()
+	class CancelContext
+	{
+	public:
+		// 单调时钟的当前毫秒数, 截止时间以此为基准
+		static uint64_t NowMS();
+
+		// 设置截止时间为ms毫秒之后
+		static void SetTimeout(uint64_t ms);
+		// 设置绝对截止时间(NowMS()为基准), ~0ull表示不限
+		static void SetDeadline(uint64_t deadline_ms);
+		static uint64_t GetDeadline();
+		// 距离截止时间的毫秒数, 没有截止时间返回~0ull, 已超时返回0
+		static uint64_t GetRemaining();
+
+		static void SetToken(CancelToken::ptr token);
+		static CancelToken::ptr GetToken();
+
+		// 返回0, 或者ETIMEDOUT/ECANCELED
+		static int Check();
+		// 当前协程是否设置了截止时间或取消令牌
+		static bool IsActive();
+	};
+
+	// 一次挂起等待 -> 在注册好正常的唤醒方式(事件、定时器、等待队列)之后、挂起之前构造
+	// 截止时间到达或令牌被取消时调用wake, wake返回true表示确实由它唤醒了协程(抢在正常唤醒之前)
+	// 恢复执行后调用finish()得到0或ETIMEDOUT/ECANCELED, 之后wake不会再被调用
+	// 当前协程没有截止时间和取消令牌时不做任何事
+	class CancelWait
+	{
+	public:
+		explicit CancelWait(std::function<bool()> wake);
+		~CancelWait();
+
+		int finish();
+
+	private:
+		std::shared_ptr<CancelWaitState> m_state;
+	};
+
+} // namespace corlib
+
+#endif
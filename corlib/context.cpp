@@ -0,0 +1,89 @@
+#include "context.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace corlib
+{
+
+	// 主协程 -> 寄存器在第一次切出时才会保存
+	int context_init(Context *ctx)
+	{
+#ifdef CORLIB_USE_UCONTEXT
+		return getcontext(&ctx->uc);
+#else
+		ctx->sp = nullptr;
+		return 0;
+#endif
+	}
+
+#ifdef CORLIB_USE_UCONTEXT
+
+	int context_make(Context *ctx, void *stack, size_t size, context_fn fn)
+	{
+		if (getcontext(&ctx->uc))
+		{
+			return -1;
+		}
+		ctx->uc.uc_link = nullptr;
+		ctx->uc.uc_stack.ss_sp = stack;
+		ctx->uc.uc_stack.ss_size = size;
+		makecontext(&ctx->uc, fn, 0);
+		return 0;
+	}
+
+	const char *context_backend()
+	{
+		return "ucontext";
+	}
+
+#else
+
+	// 在新栈顶伪造一个corlib_context_swap切出时留下的栈帧, 恢复后ret进入corlib_context_entry
+	int context_make(Context *ctx, void *stack, size_t size, context_fn fn)
+	{
+		if (!stack || size < 256)
+		{
+			return -1;
+		}
+
+		// 栈顶按16字节对齐
+		uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+		// 从低到高: mxcsr|x87控制字, r12, r13, r14, r15, rbx, rbp, 返回地址
+		// ret之后rsp = sp + 64 需要16字节对齐, 这样跳板call入口函数时满足ABI
+		void **sp = (void **)(top - 80);
+		memset(sp, 0, 80);
+		uint32_t mxcsr = 0x1F80;
+		uint16_t fpucw = 0x037F;
+		memcpy((char *)sp, &mxcsr, sizeof(mxcsr));
+		memcpy((char *)sp + 4, &fpucw, sizeof(fpucw));
+		sp[1] = (void *)fn;					   // r12 -> 入口函数
+		sp[6] = nullptr;					   // rbp -> 栈回溯到此为止
+		sp[7] = (void *)&corlib_context_entry; // 返回地址
+#elif defined(__aarch64__)
+		// 从低到高: x19-x28, x29(fp), x30(lr), d8-d15, 16字节填充
+		void **sp = (void **)(top - 176);
+		memset(sp, 0, 176);
+		sp[0] = (void *)fn;						// x19 -> 入口函数
+		sp[10] = nullptr;						// x29 -> 栈回溯到此为止
+		sp[11] = (void *)&corlib_context_entry; // x30 -> ret跳转地址
+#endif
+
+		ctx->sp = sp;
+		return 0;
+	}
+
+	const char *context_backend()
+	{
+#if defined(__x86_64__)
+		return "asm-x86_64";
+#else
+		return "asm-aarch64";
+#endif
+	}
+
+#endif
+
+} // namespace corlib
@@ -0,0 +1,71 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <stddef.h>
+
+// 上下文切换后端在编译期选择:
+// 默认在 x86-64 / aarch64 上使用手写汇编(context_swap.S), 只保存被调用者保存寄存器, 不进入内核
+// 定义 CORLIB_USE_UCONTEXT 或在其他平台上编译时, 退回到 ucontext (swapcontext 每次都会调用 rt_sigprocmask)
+#if !defined(CORLIB_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define CORLIB_USE_UCONTEXT
+#endif
+
+#ifdef CORLIB_USE_UCONTEXT
+#include <ucontext.h>
+#endif
+
+namespace corlib
+{
+
+	// 协程入口函数 -> 不允许返回
+	typedef void (*context_fn)();
+
+	// 协程上下文
+	struct Context
+	{
+#ifdef CORLIB_USE_UCONTEXT
+		ucontext_t uc;
+#else
+		// 切出时的栈顶指针 -> 被调用者保存寄存器和返回地址都压在该栈上
+		void *sp = nullptr;
+#endif
+	};
+
+} // namespace corlib
+
+#ifndef CORLIB_USE_UCONTEXT
+extern "C"
+{
+	// 保存当前寄存器到当前栈并将栈顶写入*from_sp, 然后切换到to_sp并恢复寄存器
+	void corlib_context_swap(void **from_sp, void *to_sp);
+	// 新上下文首次切入时的跳板, 调用context_make传入的入口函数
+	void corlib_context_entry();
+}
+#endif
+
+namespace corlib
+{
+
+	// 初始化一个从当前线程栈获取的上下文(主协程)
+	int context_init(Context *ctx);
+
+	// 在给定的栈上构造上下文, 首次切入时从fn开始执行
+	int context_make(Context *ctx, void *stack, size_t size, context_fn fn);
+
+	// 当前使用的切换后端名称
+	const char *context_backend();
+
+	// 保存当前上下文到from, 切换到to
+	inline int context_swap(Context *from, Context *to)
+	{
+#ifdef CORLIB_USE_UCONTEXT
+		return swapcontext(&from->uc, &to->uc);
+#else
+		corlib_context_swap(&from->sp, to->sp);
+		return 0;
+#endif
+	}
+
+} // namespace corlib
+
+#endif
@@ -5,6 +5,10 @@
 
 #include "ioscheduler.h"
 #include "hook.h"
+#include "task.h"
+#include "future.h"
+#include "offload.h"
+#include "fiber_registry.h"
 
 
 #endif
@@ -1,4 +1,9 @@
 #include "fiber.h"
+#include "stack_allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 // 控制是否打印调试信息
 static bool debug = false;
@@ -14,12 +19,29 @@ namespace corlib
 	static thread_local std::shared_ptr<Fiber> t_thread_fiber = nullptr;
 	// 调度协程
 	static thread_local Fiber *t_scheduler_fiber = nullptr;
+	// 刚刚切出、现场已保存但状态还未更新的协程 -> 由切换后运行的一方调用FinishSwitch收尾
+	static thread_local Fiber *t_switch_from = nullptr;
+	// 切出过程中被唤醒的协程(通过m_rewakeNext串成链表, 各持有一个引用) -> 由调度协程(或主协程)立即再次恢复
+	static thread_local Fiber *t_rewake = nullptr;
+	// 调度协程正在内联运行回调任务时, 回调到达挂起点需要调用的提升函数
+	static thread_local const std::function<std::shared_ptr<Fiber>()> *t_inline_promote = nullptr;
+
+	// 协程局部变量的key分配及析构函数
+	static std::atomic<int> s_local_key{0};
+	static std::atomic<void (*)(void *)> s_local_destructors[CORLIB_FIBER_LOCAL_SLOTS];
 
 	// 协程计数器
 	static std::atomic<uint64_t> s_fiber_id{0};
 	// 协程id
 	static std::atomic<uint64_t> s_fiber_count{0};
 
+	// 恢复一个正在运行或已结束的协程会切换到失效的现场、破坏栈 -> 不论是否定义NDEBUG都直接终止
+	static void ResumeFailed(const char *where, uint64_t id, int state)
+	{
+		std::cerr << where << ": fiber " << id << " is not resumable (state " << state << ")\n";
+		abort();
+	}
+
 	// 设置当前协程
 	void Fiber::SetThis(Fiber *f)
 	{
@@ -31,6 +53,11 @@ namespace corlib
 	{
 		if (t_fiber)
 		{
+			// 内联运行的回调拿到的引用可能被交给其他线程或调度器 -> 先提升为普通协程, 不能交出调度协程自己
+			if (t_inline_promote && t_fiber == t_scheduler_fiber)
+			{
+				PromoteInline();
+			}
 			return t_fiber->shared_from_this();
 		}
 
@@ -42,6 +69,62 @@ namespace corlib
 		return t_fiber->shared_from_this();
 	}
 
+	FiberRef Fiber::GetThisRef()
+	{
+		if (!t_fiber)
+		{
+			GetThis();
+		}
+		// 内联运行的回调即将挂起 -> 先提升为普通协程
+		if (t_inline_promote && t_fiber == t_scheduler_fiber)
+		{
+			PromoteInline();
+		}
+		return FiberRef(t_fiber);
+	}
+
+	Fiber *Fiber::GetThisPtr()
+	{
+		if (!t_fiber)
+		{
+			GetThis();
+		}
+		return t_fiber;
+	}
+
+	void Fiber::ref()
+	{
+		if (m_refs.fetch_add(1, std::memory_order_relaxed) != 0)
+		{
+			return;
+		}
+		// 0 -> 1: 持有自己; 与另一个线程上1 -> 0的释放竞争 -> 加锁后按最新的计数决定
+		while (m_pinLock.test_and_set(std::memory_order_acquire))
+			;
+		if (m_refs.load(std::memory_order_relaxed) > 0 && !m_self)
+		{
+			m_self = shared_from_this();
+		}
+		m_pinLock.clear(std::memory_order_release);
+	}
+
+	void Fiber::unref()
+	{
+		if (m_refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		{
+			return;
+		}
+		std::shared_ptr<Fiber> self;
+		while (m_pinLock.test_and_set(std::memory_order_acquire))
+			;
+		if (m_refs.load(std::memory_order_relaxed) == 0)
+		{
+			self.swap(m_self);
+		}
+		m_pinLock.clear(std::memory_order_release);
+		// 离开作用域时释放自身引用 -> 可能析构this, 之后不能再访问成员
+	}
+
 	// 设置调度协程
 	void Fiber::SetSchedulerFiber(Fiber *f)
 	{
@@ -58,6 +141,16 @@ namespace corlib
 		return (uint64_t)-1;
 	}
 
+	bool Fiber::InTask()
+	{
+		// 内联运行的回调可以挂起(挂起前被提升)
+		if (t_inline_promote && t_fiber == t_scheduler_fiber)
+		{
+			return true;
+		}
+		return t_fiber && t_fiber != t_scheduler_fiber && t_fiber != t_thread_fiber.get();
+	}
+
 	// 主协程构造函数
 	Fiber::Fiber()
 	{
@@ -65,7 +158,7 @@ namespace corlib
 		m_state = RUNNING;
 
 		// 获取当前上下文，失败则退出线程
-		if (getcontext(&m_ctx))
+		if (context_init(&m_ctx))
 		{
 			std::cerr << "Fiber() failed\n";
 			pthread_exit(NULL);
@@ -73,44 +166,109 @@ namespace corlib
 
 		m_id = s_fiber_id++;
 		s_fiber_count++;
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::Register(this);
+		}
 		if (debug)
 			std::cout << "Fiber(): main id = " << m_id << std::endl;
 	}
 
 	// 普通协程构造函数
-	Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
-		: m_cb(cb), m_runInScheduler(run_in_scheduler)
+	Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler, StackAllocator::Mode stack_mode)
+		: m_stackMode(stack_mode), m_cb(cb), m_runInScheduler(run_in_scheduler)
 	{
 		m_state = READY;
 
-		// 分配协程栈空间
-		m_stacksize = stacksize ? stacksize : 128000;
-		m_stack = malloc(m_stacksize);
+		// 分配协程栈空间 -> 向上取整到分配器的大小级别
+		m_stacksize = StackAllocator::RoundUp(stacksize ? stacksize : 128000);
+		m_stack = StackAllocator::Alloc(m_stacksize, m_stackMode);
+		if (!m_stack)
+		{
+			std::cerr << "Fiber() alloc stack failed, size = " << m_stacksize << std::endl;
+			pthread_exit(NULL);
+		}
+
+		// 统计栈高水位线 -> 涂满填充值
+		if (StackWatermark::IsEnabled())
+		{
+			StackWatermark::Paint(m_stack, m_stacksize);
+			m_painted = true;
+		}
 
-		if (getcontext(&m_ctx))
+		if (context_make(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc))
 		{
 			std::cerr << "Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) failed\n";
 			pthread_exit(NULL);
 		}
 
-		m_ctx.uc_link = nullptr;
-		m_ctx.uc_stack.ss_sp = m_stack;
-		m_ctx.uc_stack.ss_size = m_stacksize;
-		makecontext(&m_ctx, &Fiber::MainFunc, 0);
-
 		m_id = s_fiber_id++;
 		s_fiber_count++;
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::Register(this);
+		}
 		if (debug)
 			std::cout << "Fiber(): child id = " << m_id << std::endl;
 	}
 
+	// 共享栈协程构造函数
+	Fiber::Fiber(std::function<void()> cb, SharedStack::ptr shared_stack, bool run_in_scheduler)
+		: m_cb(cb), m_runInScheduler(run_in_scheduler)
+	{
+		m_state = READY;
+		m_stacksize = shared_stack->getSize();
+
+#ifdef CORLIB_USE_UCONTEXT
+		// ucontext无法方便地拿到切出时的栈顶 -> 使用私有栈
+		m_stackMode = StackAllocator::MMAP;
+		m_stack = StackAllocator::Alloc(m_stacksize, m_stackMode);
+		if (!m_stack || context_make(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc))
+		{
+			std::cerr << "Fiber(std::function<void()> cb, SharedStack::ptr shared_stack, bool run_in_scheduler) failed\n";
+			pthread_exit(NULL);
+		}
+#else
+		// 此时共享栈可能正被其他协程使用 -> 推迟到第一次resume时再构造上下文
+		m_sharedStack = shared_stack;
+		m_needMake = true;
+#endif
+
+		m_id = s_fiber_id++;
+		s_fiber_count++;
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::Register(this);
+		}
+		if (debug)
+			std::cout << "Fiber(): shared stack child id = " << m_id << std::endl;
+	}
+
 	// 协程析构函数
 	Fiber::~Fiber()
 	{
+		assert(m_refs.load() == 0);
+		// 先移出注册表 -> 之后导出快照的线程不会再访问本协程
+		if (m_registry.shard >= 0)
+		{
+			FiberRegistry::Unregister(this);
+		}
 		s_fiber_count--;
+		clearLocals();
 		if (m_stack)
 		{
-			free(m_stack);
+			StackAllocator::Dealloc(m_stack, m_stacksize, m_stackMode);
+		}
+		if (m_sharedStack)
+		{
+			// 栈上还保存着自己的现场 -> 清除占用者, 避免下一个协程保存已析构的协程
+			if (m_sharedStack->m_occupant.load() == this)
+			{
+				std::lock_guard<std::mutex> lock(m_sharedStack->m_mutex);
+				Fiber *self = this;
+				m_sharedStack->m_occupant.compare_exchange_strong(self, nullptr);
+			}
+			free(m_saveBuffer);
 		}
 		if (debug)
 			std::cout << "~Fiber(): id = " << m_id << std::endl;
@@ -119,94 +277,436 @@ namespace corlib
 	// 重置协程的执行函数
 	void Fiber::reset(std::function<void()> cb)
 	{
-		assert(m_stack != nullptr && m_state == TERM);
+		assert((m_stack != nullptr || m_sharedStack) && m_state == TERM);
 
-		m_state = READY;
+		m_state.store(READY, std::memory_order_relaxed);
 		m_cb = cb;
 
-		if (getcontext(&m_ctx))
+		if (m_sharedStack)
+		{
+			m_needMake = true;
+			return;
+		}
+
+		// 只需要重新涂上一次任务弄脏的部分
+		if (m_painted)
+		{
+			size_t dirty = (m_stackHighWater + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+			StackWatermark::Paint((char *)m_stack + m_stacksize - dirty, dirty);
+		}
+		else if (StackWatermark::IsEnabled())
+		{
+			StackWatermark::Paint(m_stack, m_stacksize);
+			m_painted = true;
+		}
+
+		if (context_make(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc))
 		{
 			std::cerr << "reset() failed\n";
 			pthread_exit(NULL);
 		}
-
-		m_ctx.uc_link = nullptr;
-		m_ctx.uc_stack.ss_sp = m_stack;
-		m_ctx.uc_stack.ss_size = m_stacksize;
-		makecontext(&m_ctx, &Fiber::MainFunc, 0);
 	}
 
 	// 恢复协程的执行
 	void Fiber::resume()
 	{
-		assert(m_state == READY);
+		if (m_sharedStack)
+		{
+			m_sharedStack->m_mutex.lock();
+		}
+		State state = m_state.load(std::memory_order_acquire);
+		if (!((state == READY || state == SUSPENDED) &&
+			  m_state.compare_exchange_strong(state, RUNNING, std::memory_order_acq_rel)))
+		{
+			ResumeFailed("resume()", m_id, state);
+		}
 
-		m_state = RUNNING;
+		doResume();
+	}
 
-		if (m_runInScheduler)
+	// 调度器恢复被唤醒的协程
+	bool Fiber::tryResume(bool *stack_busy)
+	{
+		State state = m_state.load(std::memory_order_acquire);
+		while (true)
 		{
-			SetThis(this);
-			if (swapcontext(&(t_scheduler_fiber->m_ctx), &m_ctx))
+			switch (state)
 			{
-				std::cerr << "resume() to t_scheduler_fiber failed\n";
-				pthread_exit(NULL);
+			case READY:
+			case SUSPENDED:
+				if (m_sharedStack)
+				{
+					// 共享栈正被其他线程上的协程使用 -> 不阻塞线程, 交给调用者重新排队
+					if (stack_busy)
+					{
+						if (!m_sharedStack->m_mutex.try_lock())
+						{
+							*stack_busy = true;
+							return false;
+						}
+					}
+					else
+					{
+						m_sharedStack->m_mutex.lock();
+					}
+				}
+				if (m_state.compare_exchange_weak(state, RUNNING, std::memory_order_acq_rel))
+				{
+					doResume();
+					return true;
+				}
+				if (m_sharedStack)
+				{
+					m_sharedStack->m_mutex.unlock();
+				}
+				break;
+			case RUNNING:
+				// 协程还在运行或者现场还没保存完 -> 只记下这次唤醒, 由运行它的线程负责
+				if (m_state.compare_exchange_weak(state, RUNNABLE, std::memory_order_acq_rel))
+				{
+					return false;
+				}
+				break;
+			default:
+				// 已经有一次未处理的唤醒, 或者协程已结束
+				return false;
 			}
 		}
-		else
+	}
+
+	// 切换到已经置为RUNNING的协程 -> 在调度协程(或主协程)上执行
+	void Fiber::doResume()
+	{
+		// 从t_rewake取出的协程持有的引用, 切回之后释放
+		Fiber *held = nullptr;
+		Fiber *next = this;
+		while (next)
 		{
-			SetThis(this);
-			if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
+			if (next->m_sharedStack)
 			{
-				std::cerr << "resume() to t_thread_fiber failed\n";
+				next->switchInSharedStack();
+			}
+
+			Fiber *from = next->m_runInScheduler ? t_scheduler_fiber : t_thread_fiber.get();
+			assert(from == t_fiber);
+			SetThis(next);
+			if (context_swap(&from->m_ctx, &next->m_ctx))
+			{
+				std::cerr << (next->m_runInScheduler ? "resume() to t_scheduler_fiber failed\n" : "resume() to t_thread_fiber failed\n");
 				pthread_exit(NULL);
 			}
+
+			// 已切回 -> 运行在调度协程(或主协程)的栈上
+			FinishSwitch();
+
+			if (held)
+			{
+				held->unref();
+			}
+
+			// 切出过程中被唤醒的协程 -> 在这里直接再次恢复
+			next = held = t_rewake;
+			if (next)
+			{
+				t_rewake = next->m_rewakeNext;
+				next->m_rewakeNext = nullptr;
+			}
 		}
 	}
 
-	// 挂起协程的执行
-	void Fiber::yield()
+	// 收尾上一个切出的协程 -> 此时它的现场已经保存在自己的栈上
+	void Fiber::FinishSwitch()
 	{
-		assert(m_state == RUNNING || m_state == TERM);
+		Fiber *prev = t_switch_from;
+		if (!prev)
+		{
+			return;
+		}
+		t_switch_from = nullptr;
 
-		if (m_state != TERM)
+		State state = prev->m_state.load(std::memory_order_acquire);
+		if (state == TERM)
 		{
-			m_state = READY;
+			if (prev->m_sharedStack)
+			{
+				prev->switchOutSharedStack();
+			}
+			if (prev->m_painted)
+			{
+				// 任务结束 -> 记录栈高水位线
+				prev->m_stackHighWater = StackWatermark::Measure(prev->m_stack, prev->m_stacksize);
+				StackWatermark::Record(prev->m_stacksize, prev->m_stackHighWater);
+			}
+			if (prev->m_pinned)
+			{
+				// 已经切出 -> 可以释放固定的引用
+				prev->m_pinned = false;
+				prev->unref();
+			}
+			return;
 		}
 
-		if (m_runInScheduler)
+		// 发布SUSPENDED之后其他线程才可以恢复它
+		// 共享栈在发布之后才释放 -> 切出过程中被唤醒时继续持有, 由本线程重新运行而不必再次占用
+		SharedStack *stack = prev->m_sharedStack.get();
+		state = RUNNING;
+		if (prev->m_state.compare_exchange_strong(state, SUSPENDED, std::memory_order_acq_rel))
 		{
-			SetThis(t_scheduler_fiber);
-			if (swapcontext(&m_ctx, &(t_scheduler_fiber->m_ctx)))
+			if (stack)
 			{
-				std::cerr << "yield() to to t_scheduler_fiber failed\n";
-				pthread_exit(NULL);
+				stack->m_mutex.unlock();
 			}
 		}
 		else
 		{
-			SetThis(t_thread_fiber.get());
-			if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)))
+			// 切出过程中收到了唤醒 -> 唤醒方已放弃, 由本线程重新运行
+			assert(state == RUNNABLE);
+			prev->m_state.store(RUNNING, std::memory_order_relaxed);
+			prev->ref();
+			prev->m_rewakeNext = t_rewake;
+			t_rewake = prev;
+		}
+	}
+
+	// 协程之间直接切换
+	void Fiber::transferTo(const std::shared_ptr<Fiber> &target)
+	{
+		if (t_inline_promote && this == t_scheduler_fiber)
+		{
+			PromoteInline();
+		}
+		assert(t_fiber == this && (m_state == RUNNING || m_state == RUNNABLE));
+		assert(this != t_scheduler_fiber && this != t_thread_fiber.get());
+		assert(target && target.get() != this);
+		assert(target->m_runInScheduler == m_runInScheduler);
+		assert(!m_sharedStack && !target->m_sharedStack);
+
+		State state = target->m_state.load(std::memory_order_acquire);
+		if (!((state == READY || state == SUSPENDED) &&
+			  target->m_state.compare_exchange_strong(state, RUNNING, std::memory_order_acq_rel)))
+		{
+			ResumeFailed("transferTo()", target->m_id, state);
+		}
+
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::OnPark(this);
+		}
+
+		// 自己的状态由target在切换完成后更新
+		t_switch_from = this;
+		SetThis(target.get());
+		if (context_swap(&m_ctx, &target->m_ctx))
+		{
+			std::cerr << "transferTo() failed\n";
+			pthread_exit(NULL);
+		}
+		FinishSwitch();
+
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::OnResume(this);
+		}
+	}
+
+	size_t Fiber::getStackHighWater() const
+	{
+		if (!m_painted)
+		{
+			return 0;
+		}
+		return m_state == TERM ? m_stackHighWater : StackWatermark::Measure(m_stack, m_stacksize);
+	}
+
+	size_t Fiber::reclaimStack(bool *woken, bool *retry)
+	{
+		*woken = false;
+		if (retry)
+		{
+			*retry = false;
+		}
+#ifdef CORLIB_USE_UCONTEXT
+		return 0;
+#else
+		// 共享栈协程挂起时已经只保存使用的部分; 释放的页读回为0, 会破坏高水位线的填充值
+		if (!m_stack || m_sharedStack || m_painted)
+		{
+			return 0;
+		}
+
+		// 和恢复方一样先把状态改为RUNNING -> 释放期间协程不会被恢复, 到达的唤醒变为RUNNABLE
+		State state = SUSPENDED;
+		if (!m_state.compare_exchange_strong(state, RUNNING, std::memory_order_acq_rel))
+		{
+			// 还没切出完成 -> 之后可能挂起; 已被唤醒或已结束则不再需要
+			if (retry && state == RUNNING)
+			{
+				*retry = true;
+			}
+			return 0;
+		}
+
+		// 保留栈顶以下的红区(x86-64 ABI为128字节), 只释放完整的页
+		static const uintptr_t page = sysconf(_SC_PAGESIZE);
+		uintptr_t begin = ((uintptr_t)m_stack + page - 1) & ~(page - 1);
+		uintptr_t end = ((uintptr_t)m_ctx.sp - 128) & ~(page - 1);
+		size_t len = end > begin ? end - begin : 0;
+		if (len && madvise((void *)begin, len, MADV_DONTNEED))
+		{
+			len = 0;
+		}
+
+		state = RUNNING;
+		if (!m_state.compare_exchange_strong(state, SUSPENDED, std::memory_order_acq_rel))
+		{
+			// 释放期间收到了唤醒 -> 唤醒方已放弃, 由调用者重新调度
+			assert(state == RUNNABLE);
+			m_state.store(SUSPENDED, std::memory_order_release);
+			*woken = true;
+		}
+		return len;
+#endif
+	}
+
+	// 在调度协程的栈上执行 -> 调度协程不能使用共享栈
+	// 调用者已经占用了共享栈(resume/tryResume加锁, 或切出过程中被唤醒时没有释放), 直到本协程切出之前其他线程都不能使用它
+	void Fiber::switchInSharedStack()
+	{
+		SharedStack *stack = m_sharedStack.get();
+
+		Fiber *occupant = stack->m_occupant.load();
+		if (occupant != this)
+		{
+			// 换下原来的协程
+			if (occupant)
+			{
+				occupant->saveSharedStack();
+			}
+			stack->m_occupant = this;
+
+			// 恢复自己的栈
+			if (!m_needMake)
+			{
+				memcpy(stack->getTop() - m_saveSize, m_saveBuffer, m_saveSize);
+			}
+		}
+
+		if (m_needMake)
+		{
+			m_needMake = false;
+			if (context_make(&m_ctx, stack->getBottom(), stack->getSize(), &Fiber::MainFunc))
 			{
-				std::cerr << "yield() to t_thread_fiber failed\n";
+				std::cerr << "resume() make context on shared stack failed\n";
 				pthread_exit(NULL);
 			}
 		}
 	}
 
+	void Fiber::switchOutSharedStack()
+	{
+		SharedStack *stack = m_sharedStack.get();
+		// 协程已结束 -> 栈上的内容不再需要保存
+		stack->m_occupant = nullptr;
+		free(m_saveBuffer);
+		m_saveBuffer = nullptr;
+		m_saveSize = 0;
+		m_saveCapacity = 0;
+		stack->m_mutex.unlock();
+	}
+
+	void Fiber::saveSharedStack()
+	{
+#ifndef CORLIB_USE_UCONTEXT
+		char *sp = (char *)m_ctx.sp;
+		size_t used = m_sharedStack->getTop() - sp;
+		if (used > m_saveCapacity)
+		{
+			// 正在换入另一个协程 -> 没有办法报告错误, 直接终止而不是写空指针
+			char *buffer = (char *)realloc(m_saveBuffer, used);
+			if (!buffer)
+			{
+				std::cerr << "saveSharedStack() failed to allocate " << used << " bytes for fiber " << m_id << "\n";
+				abort();
+			}
+			m_saveBuffer = buffer;
+			m_saveCapacity = used;
+		}
+		memcpy(m_saveBuffer, sp, used);
+		m_saveSize = used;
+#endif
+	}
+
+	// 挂起协程的执行
+	void Fiber::yield()
+	{
+		if (t_inline_promote && this == t_scheduler_fiber)
+		{
+			PromoteInline();
+		}
+
+		State state = m_state.load(std::memory_order_acquire);
+		// 挂起之前已经被唤醒 -> 不需要切出
+		if (state == RUNNABLE && m_state.compare_exchange_strong(state, RUNNING, std::memory_order_acq_rel))
+		{
+			if (FiberRegistry::IsEnabled())
+			{
+				FiberRegistry::OnResume(this);
+			}
+			return;
+		}
+		assert(state == RUNNING || state == TERM);
+
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::OnPark(this);
+		}
+
+		// 状态在切换完成后由FinishSwitch更新, 在此之前其他线程不会恢复本协程
+		Fiber *to = m_runInScheduler ? t_scheduler_fiber : t_thread_fiber.get();
+		t_switch_from = this;
+		SetThis(to);
+		if (context_swap(&m_ctx, &to->m_ctx))
+		{
+			std::cerr << (m_runInScheduler ? "yield() to to t_scheduler_fiber failed\n" : "yield() to t_thread_fiber failed\n");
+			pthread_exit(NULL);
+		}
+		FinishSwitch();
+
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::OnResume(this);
+		}
+	}
+
 	void Fiber::yieldToReady()
 	{
-		Fiber::GetThis()->yield();
+		// 直接使用裸指针 -> 不需要增减引用计数
+		if (!t_fiber)
+		{
+			GetThis();
+		}
+		t_fiber->yield();
 	}
 
 	// 协程的主函数
 	void Fiber::MainFunc()
 	{
+		// 可能是由transferTo第一次切入 -> 先收尾切出的协程
+		FinishSwitch();
+
 		std::shared_ptr<Fiber> curr = GetThis();
 		assert(curr != nullptr);
 
+		if (FiberRegistry::IsEnabled())
+		{
+			FiberRegistry::OnResume(curr.get());
+		}
+
 		curr->m_cb();
 		curr->m_cb = nullptr;
-		curr->m_state = TERM;
+		// 协程局部变量的生命周期与任务一致 -> 复用协程之前先析构
+		curr->clearLocals();
+		curr->m_state.store(TERM, std::memory_order_release);
 
 		// 运行完毕 -> 让出执行权
 		auto raw_ptr = curr.get();
@@ -214,4 +714,105 @@ namespace corlib
 		raw_ptr->yield();
 	}
 
+	bool Fiber::RunInline(const std::function<void()> &cb, const std::function<std::shared_ptr<Fiber>()> &promote)
+	{
+		Fiber *self = t_fiber;
+		// 调度协程必须是独立的协程(不是线程主协程), 才能被提升后迁移到其他线程
+		assert(self && self == t_scheduler_fiber && self != t_thread_fiber.get());
+		assert(!t_inline_promote);
+
+		t_inline_promote = &promote;
+		cb();
+		// 协程局部变量的生命周期与任务一致
+		self->clearLocals();
+		if (self->m_promoted)
+		{
+			// 此时可能运行在其他线程上, 不能再访问原线程的状态
+			return false;
+		}
+		t_inline_promote = nullptr;
+		return true;
+	}
+
+	void Fiber::PromoteInline()
+	{
+		const std::function<std::shared_ptr<Fiber>()> *promote = t_inline_promote;
+		t_inline_promote = nullptr;
+
+		Fiber *self = t_fiber;
+		assert(!self->m_sharedStack && !self->m_promoted);
+		self->m_promoted = true;
+		if (!self->m_pinned)
+		{
+			self->ref();
+			self->m_pinned = true;
+		}
+
+		std::shared_ptr<Fiber> loop = (*promote)();
+		assert(loop && loop->m_state == READY && !loop->m_runInScheduler && !loop->m_sharedStack);
+		loop->ref();
+		loop->m_pinned = true;
+		// 新的调度协程在当前协程第一次让出时从头开始运行, 视为已在运行
+		loop->m_state.store(RUNNING, std::memory_order_relaxed);
+		self->m_runInScheduler = true;
+		t_scheduler_fiber = loop.get();
+	}
+
+	int Fiber::CreateLocalKey(void (*destructor)(void *))
+	{
+		int key = s_local_key.fetch_add(1);
+		if (key >= CORLIB_FIBER_LOCAL_SLOTS)
+		{
+			s_local_key = CORLIB_FIBER_LOCAL_SLOTS;
+			return -1;
+		}
+		s_local_destructors[key] = destructor;
+		return key;
+	}
+
+	void Fiber::SetLocal(int key, void *value)
+	{
+		if (key < 0 || key >= CORLIB_FIBER_LOCAL_SLOTS)
+		{
+			return;
+		}
+		Fiber *curr = GetThisPtr();
+		curr->m_locals[key] = value;
+		if (value)
+		{
+			curr->m_localMask |= (1u << key);
+		}
+		else
+		{
+			curr->m_localMask &= ~(1u << key);
+		}
+	}
+
+	void *Fiber::GetLocal(int key)
+	{
+		if (key < 0 || key >= CORLIB_FIBER_LOCAL_SLOTS)
+		{
+			return nullptr;
+		}
+		return GetThisPtr()->m_locals[key];
+	}
+
+	void Fiber::clearLocals()
+	{
+		// 析构函数中可能再次设置局部变量 -> 循环直到全部清空
+		while (m_localMask)
+		{
+			int key = __builtin_ctz(m_localMask);
+			void *value = m_locals[key];
+			m_locals[key] = nullptr;
+			m_localMask &= ~(1u << key);
+
+			void (*destructor)(void *) = s_local_destructors[key].load();
+			if (destructor && value)
+			{
+				destructor(value);
+			}
+		}
+	}
+
 } // namespace corlib
@@ -6,22 +6,46 @@
 #include <atomic>
 #include <functional>
 #include <cassert>
-#include <ucontext.h>
+#include <cstdlib>
 #include <unistd.h>
 #include <mutex>
 
+#include "context.h"
+#include "stack_allocator.h"
+#include "fiber_registry.h"
+
+// 每个协程内联保存的协程局部变量个数
+#ifndef CORLIB_FIBER_LOCAL_SLOTS
+#define CORLIB_FIBER_LOCAL_SLOTS 16
+#endif
+// 槽位是否有值记录在32位的m_localMask中
+static_assert(CORLIB_FIBER_LOCAL_SLOTS > 0 && CORLIB_FIBER_LOCAL_SLOTS <= 32, "CORLIB_FIBER_LOCAL_SLOTS must be in [1, 32]");
+
 namespace corlib
 {
 
+	class FiberRef;
+
 	class Fiber : public std::enable_shared_from_this<Fiber>
 	{
+		friend class FiberRef;
+		friend class FiberRegistry;
 	public:
 		typedef std::shared_ptr<Fiber> ptr;
 		// 协程状态
+		// READY/SUSPENDED -> RUNNING 由恢复方用CAS完成, 保证同一协程不会被两个线程同时恢复
+		// 切出时现场保存完毕之后才由RUNNING变为SUSPENDED; 在此之前到达的唤醒把状态改为RUNNABLE,
+		// 挂起时发现RUNNABLE则不再切出, 已经切出的则由切出所在的线程立即再次恢复
 		enum State
 		{
+			// 新建或reset之后, 还没有运行
 			READY,
+			// 正在运行(或正在切出, 现场还没保存完)
 			RUNNING,
+			// 已挂起, 现场已保存, 可以被恢复
+			SUSPENDED,
+			// 运行中收到了唤醒
+			RUNNABLE,
 			TERM
 		};
 
@@ -30,56 +54,255 @@ namespace corlib
 		Fiber();
 
 	public:
-		Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+		// stacksize -> 栈大小(MMAP模式下为预留的地址空间大小), 0表示默认大小
+		// stack_mode -> 栈的来源, 见StackAllocator::Mode
+		Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true,
+			  StackAllocator::Mode stack_mode = StackAllocator::MALLOC);
+		// 在共享栈上运行的协程 -> 挂起时只保存栈上实际使用的部分
+		// 需要汇编切换后端, 使用ucontext时退化为分配同样大小的私有栈
+		Fiber(std::function<void()> cb, SharedStack::ptr shared_stack, bool run_in_scheduler = true);
 		~Fiber();
 
 		// 重用一个协程
 		void reset(std::function<void()> cb);
 
-		// 任务线程恢复执行
+		// 任务线程恢复执行 -> 协程必须处于READY或SUSPENDED状态; 共享栈被其他线程占用时阻塞等待
 		void resume();
+		// 调度器恢复被唤醒的协程: 如果协程还在运行或正在切出, 只记下唤醒并返回false,
+		// 协程挂起时不再切出(或切出后立即被再次恢复); 已结束或已有未处理的唤醒时也返回false
+		// 传入stack_busy时不等待被其他线程占用的共享栈: 置*stack_busy为true并返回false, 唤醒没有被记下, 调用者需要重新调度它
+		bool tryResume(bool *stack_busy = nullptr);
 		// 任务线程让出执行权
 		void yield();
 
 		static void yieldToReady();
 
+		// 由当前运行的协程直接切换到target, 不经过调度协程(一次切换代替yield+resume两次切换)
+		// 当前协程变为SUSPENDED, 之后由resume()或另一次transferTo()恢复
+		// target必须处于READY或SUSPENDED状态且与当前协程让出到同一个协程(m_runInScheduler相同), 调用者需保证target的生命周期
+		// 两者都不能使用共享栈: 共享栈的换入换出由resume()在调度协程的栈上完成
+		void transferTo(const std::shared_ptr<Fiber> &target);
+
 		uint64_t getId() const { return m_id; }
-		State getState() const { return m_state; }
+		State getState() const { return m_state.load(std::memory_order_acquire); }
+		size_t getStackSize() const { return m_stacksize; }
+		StackAllocator::Mode getStackMode() const { return m_stackMode; }
+		bool isSharedStack() const { return m_sharedStack != nullptr; }
+		// 共享栈协程被换下时保存的栈大小
+		size_t getSavedStackSize() const { return m_saveSize; }
+		// 栈曾经使用过的最大深度, 需要开启StackWatermark, 未开启时返回0
+		size_t getStackHighWater() const;
+		// 释放挂起协程栈上当前栈顶以下(未使用部分)的物理页, 返回释放范围的字节数(包括本来就没有驻留的页)
+		// 只处理SUSPENDED状态、使用私有栈的协程(需要汇编切换后端, 涂了高水位线填充值的栈也不处理)
+		// 期间到达的唤醒会被暂存: *woken为true时调用者需要重新调度该协程
+		// 传入retry时, 协程还没有挂起(仍在运行或正在切出)而没有处理的情况置*retry为true, 调用者可以稍后再试
+		size_t reclaimStack(bool *woken, bool *retry = nullptr);
 
 	public:
 		// 设置当前运行的协程
 		static void SetThis(Fiber *f);
 
-		// 得到当前运行的协程
+		// 得到当前运行的协程; 在内联运行的回调中调用时先把它提升为普通协程(同GetThisRef)
 		static std::shared_ptr<Fiber> GetThis();
 
+		// 得到当前运行协程的侵入式引用 -> 不经过shared_ptr的控制块, 用于频繁挂起/唤醒的路径
+		static FiberRef GetThisRef();
+
+		// 得到当前运行协程的裸指针 -> 不增减引用计数, 也不提升内联运行的回调(可能得到调度协程),
+		// 只在当前协程内使用, 不能保存或交给其他线程; 需要转交时使用GetThis/GetThisRef
+		static Fiber *GetThisPtr();
+
 		// 设置调度协程（默认为主协程）
 		static void SetSchedulerFiber(Fiber *f);
 
 		// 得到当前运行的协程id
 		static uint64_t GetFiberId();
 
+		// 当前是否运行在可以挂起的任务协程中(不是线程主协程或调度协程)
+		static bool InTask();
+
 		// 协程函数
 		static void MainFunc();
 
+		// 在调度协程上直接运行回调任务 -> 不创建协程, 也不切换上下文
+		// 回调到达挂起点(GetThis/GetThisRef/yield/transferTo)时调用promote: 当前调度协程被提升为普通协程继续运行回调,
+		// promote返回的新协程(READY, 让出到主协程)从回调第一次让出时开始接替调度协程
+		// 返回true表示回调在调度协程上运行完毕; 返回false表示回调已在被提升的协程上结束, 调用者应立即返回
+		static bool RunInline(const std::function<void()> &cb, const std::function<std::shared_ptr<Fiber>()> &promote);
+
+	public:
+		// 协程局部存储(类似libco的co_setspecific/co_getspecific)
+		// 值直接存放在Fiber对象内的槽位中, key即槽位下标, 访问为O(1)且不需要加锁
+		// 协程任务结束(包括被reset复用之前)或析构时, 对非空的值调用创建key时传入的destructor
+
+		// 创建一个key, 槽位用完返回-1; key不会回收, 适合用于全局/静态变量
+		static int CreateLocalKey(void (*destructor)(void *) = nullptr);
+		// 设置/获取当前协程key对应的值; 无效的key(如CreateLocalKey返回的-1)设置时忽略, 获取时返回nullptr
+		static void SetLocal(int key, void *value);
+		static void *GetLocal(int key);
+
+	private:
+		// 析构所有协程局部变量
+		void clearLocals();
+
+		// 侵入式引用计数: 计数从0变为1时用shared_from_this()持有自己, 回到0时释放
+		// 因此FiberRef与shared_ptr可以混用, 只有计数在0和1之间变化时才会访问shared_ptr的控制块
+		void ref();
+		void unref();
+
+	private:
+		// 切换到状态已置为RUNNING的协程
+		void doResume();
+		// 切换完成后更新刚切出的协程的状态
+		static void FinishSwitch();
+		// 把内联运行回调的调度协程提升为普通协程
+		static void PromoteInline();
+
+	private:
+		// 切换到共享栈协程之前 -> 占用共享栈, 换下原来的协程并恢复自己的栈
+		void switchInSharedStack();
+		// 共享栈协程结束之后 -> 清除栈上的内容并释放共享栈
+		void switchOutSharedStack();
+		// 把栈上活跃的部分拷贝到保存缓冲区
+		void saveSharedStack();
+
 	private:
 		// id
 		uint64_t m_id = 0;
 		// 栈大小
 		uint32_t m_stacksize = 0;
 		// 协程状态
-		State m_state = READY;
+		std::atomic<State> m_state = {READY};
 		// 协程上下文
-		ucontext_t m_ctx;
+		Context m_ctx;
 		// 协程栈指针
 		void *m_stack = nullptr;
+		// 协程栈的来源
+		StackAllocator::Mode m_stackMode = StackAllocator::MALLOC;
+		// 共享栈
+		SharedStack::ptr m_sharedStack;
+		// 共享栈被其他协程占用时, 保存自己栈内容的缓冲区
+		char *m_saveBuffer = nullptr;
+		size_t m_saveSize = 0;
+		size_t m_saveCapacity = 0;
+		// 共享栈协程的初始上下文需要在第一次占用共享栈时再构造
+		bool m_needMake = false;
+		// 栈是否已涂上填充值, 以及上一次任务结束时测得的栈高水位线
+		bool m_painted = false;
+		size_t m_stackHighWater = 0;
 		// 协程函数
 		std::function<void()> m_cb;
 		// 是否让出执行权交给调度协程
 		bool m_runInScheduler;
+		// 由内联运行回调的调度协程提升而来
+		bool m_promoted = false;
+		// 被提升的协程及接替它的调度协程没有其他持有者 -> 固定自身的引用, 结束并切出后释放
+		bool m_pinned = false;
+		// 协程局部变量及非空槽位的掩码
+		void *m_locals[CORLIB_FIBER_LOCAL_SLOTS] = {};
+		uint32_t m_localMask = 0;
+		// 侵入式引用计数及其持有的自身引用
+		std::atomic<uint32_t> m_refs = {0};
+		std::atomic_flag m_pinLock = ATOMIC_FLAG_INIT;
+		std::shared_ptr<Fiber> m_self;
+		// 等待被再次恢复的链表中的下一个协程
+		Fiber *m_rewakeNext = nullptr;
+		// 注册表节点及诊断信息, 见FiberRegistry
+		FiberRegistryNode m_registry;
+	};
+
+	// 协程的侵入式引用
+	// 复制/销毁只增减Fiber内的计数, 移动不触碰计数; 调度队列、事件上下文和hook中挂起的协程都通过它持有
+	class FiberRef
+	{
+	public:
+		FiberRef() = default;
+		FiberRef(Fiber *fiber) : m_fiber(fiber)
+		{
+			if (m_fiber)
+			{
+				m_fiber->ref();
+			}
+		}
+		FiberRef(const std::shared_ptr<Fiber> &fiber) : FiberRef(fiber.get()) {}
+		FiberRef(const FiberRef &other) : FiberRef(other.m_fiber) {}
+		FiberRef(FiberRef &&other) noexcept : m_fiber(other.m_fiber) { other.m_fiber = nullptr; }
+		~FiberRef() { reset(); }
+
+		FiberRef &operator=(FiberRef other) noexcept
+		{
+			swap(other);
+			return *this;
+		}
+
+		void swap(FiberRef &other) noexcept { std::swap(m_fiber, other.m_fiber); }
+
+		void reset()
+		{
+			if (m_fiber)
+			{
+				Fiber *fiber = m_fiber;
+				m_fiber = nullptr;
+				fiber->unref();
+			}
+		}
 
+		Fiber *get() const { return m_fiber; }
+		Fiber *operator->() const { return m_fiber; }
+		Fiber &operator*() const { return *m_fiber; }
+		explicit operator bool() const { return m_fiber != nullptr; }
+
+		// 转换为shared_ptr, 兼容使用Fiber::ptr的接口
+		std::shared_ptr<Fiber> toShared() const { return m_fiber ? m_fiber->shared_from_this() : nullptr; }
+
+	private:
+		Fiber *m_fiber = nullptr;
+	};
+
+	// 协程局部变量 -> 每个协程一份, 首次访问时默认构造, 协程任务结束时析构
+	// 用法: static FiberLocal<RequestContext> t_ctx; t_ctx->trace_id = ...;
+	template <class T>
+	class FiberLocal
+	{
 	public:
-		std::mutex m_mutex;
+		// 槽位用完 -> 之后的每次访问都会失败, 不论是否定义NDEBUG都直接终止(调大CORLIB_FIBER_LOCAL_SLOTS)
+		FiberLocal() : m_key(Fiber::CreateLocalKey(&FiberLocal::Destroy))
+		{
+			if (m_key < 0)
+			{
+				std::cerr << "FiberLocal: out of fiber local slots (CORLIB_FIBER_LOCAL_SLOTS = " << CORLIB_FIBER_LOCAL_SLOTS << ")\n";
+				abort();
+			}
+		}
+
+		T *get()
+		{
+			void *value = Fiber::GetLocal(m_key);
+			if (!value)
+			{
+				value = new T();
+				Fiber::SetLocal(m_key, value);
+			}
+			return (T *)value;
+		}
+
+		// 不创建, 当前协程还没有值时返回nullptr
+		T *peek()
+		{
+			return (T *)Fiber::GetLocal(m_key);
+		}
+
+		T *operator->() { return get(); }
+		T &operator*() { return *get(); }
+
+	private:
+		static void Destroy(void *value)
+		{
+			delete (T *)value;
+		}
+
+	private:
+		int m_key;
 	};
 
 }
@@ -0,0 +1,334 @@
+#include "fiber_registry.h"
+#include "fiber.h"
+#include "ioscheduler.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+
+namespace corlib
+{
+
+	std::atomic<bool> FiberRegistry::s_enabled{false};
+
+	// 按协程id分片, 减少创建/销毁协程时的锁竞争
+	static const int kRegistryShards = 16;
+
+	struct RegistryShard
+	{
+		std::mutex mutex;
+		Fiber *head = nullptr;
+		size_t count = 0;
+	};
+
+	static RegistryShard s_shards[kRegistryShards];
+
+	// 信号处理函数写入, 后台线程读取
+	static int s_dump_pipe[2] = {-1, -1};
+
+	// 挂起时间只需要毫秒精度 -> 使用开销更小的粗粒度时钟
+	static uint64_t NowMS()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+	}
+
+	static int CurrentThreadId()
+	{
+		static thread_local int t_tid = 0;
+		if (!t_tid)
+		{
+			t_tid = Thread::GetThreadId();
+		}
+		return t_tid;
+	}
+
+	void FiberRegistry::SetEnabled(bool enabled)
+	{
+		s_enabled = enabled;
+	}
+
+	void FiberRegistry::Register(Fiber *fiber)
+	{
+		FiberRegistryNode &node = fiber->m_registry;
+		node.shard = fiber->m_id % kRegistryShards;
+		// 主协程在创建它的线程上运行
+		if (!fiber->m_stack && !fiber->m_sharedStack)
+		{
+			node.thread.store(CurrentThreadId(), std::memory_order_relaxed);
+		}
+
+		RegistryShard &shard = s_shards[node.shard];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		node.next = shard.head;
+		if (shard.head)
+		{
+			shard.head->m_registry.prev = fiber;
+		}
+		shard.head = fiber;
+		shard.count++;
+	}
+
+	void FiberRegistry::Unregister(Fiber *fiber)
+	{
+		FiberRegistryNode &node = fiber->m_registry;
+		RegistryShard &shard = s_shards[node.shard];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (node.prev)
+		{
+			node.prev->m_registry.next = node.next;
+		}
+		else
+		{
+			shard.head = node.next;
+		}
+		if (node.next)
+		{
+			node.next->m_registry.prev = node.prev;
+		}
+		node.prev = node.next = nullptr;
+		node.shard = -1;
+		shard.count--;
+	}
+
+	void FiberRegistry::OnPark(Fiber *fiber)
+	{
+		FiberRegistryNode &node = fiber->m_registry;
+		if (node.shard >= 0)
+		{
+			node.park_ms.store(NowMS(), std::memory_order_relaxed);
+		}
+	}
+
+	void FiberRegistry::OnResume(Fiber *fiber)
+	{
+		FiberRegistryNode &node = fiber->m_registry;
+		if (node.shard >= 0)
+		{
+			node.thread.store(CurrentThreadId(), std::memory_order_relaxed);
+			node.reason.store(WAIT_NONE, std::memory_order_relaxed);
+			node.fd.store(-1, std::memory_order_relaxed);
+			node.arg.store(0, std::memory_order_relaxed);
+			node.park_ms.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void FiberRegistry::SetWaitReason(WaitReason reason, int fd, uint64_t arg)
+	{
+		if (!IsEnabled())
+		{
+			return;
+		}
+		Fiber *fiber = Fiber::GetThisPtr();
+		FiberRegistryNode &node = fiber->m_registry;
+		if (node.shard >= 0)
+		{
+			node.reason.store(reason, std::memory_order_relaxed);
+			node.fd.store(fd, std::memory_order_relaxed);
+			node.arg.store(arg, std::memory_order_relaxed);
+		}
+	}
+
+	size_t FiberRegistry::GetCount()
+	{
+		size_t count = 0;
+		for (int i = 0; i < kRegistryShards; i++)
+		{
+			std::lock_guard<std::mutex> lock(s_shards[i].mutex);
+			count += s_shards[i].count;
+		}
+		return count;
+	}
+
+	std::vector<FiberRegistry::FiberInfo> FiberRegistry::Snapshot()
+	{
+		std::vector<FiberInfo> infos;
+		uint64_t now = NowMS();
+		for (int i = 0; i < kRegistryShards; i++)
+		{
+			std::lock_guard<std::mutex> lock(s_shards[i].mutex);
+			for (Fiber *fiber = s_shards[i].head; fiber; fiber = fiber->m_registry.next)
+			{
+				const FiberRegistryNode &node = fiber->m_registry;
+				FiberInfo info;
+				info.id = fiber->m_id;
+				info.state = fiber->getState();
+				info.thread = node.thread.load(std::memory_order_relaxed);
+				info.main = !fiber->m_stack && !fiber->m_sharedStack;
+				info.stacksize = fiber->m_stacksize;
+				info.reason = (WaitReason)node.reason.load(std::memory_order_relaxed);
+				info.fd = node.fd.load(std::memory_order_relaxed);
+				info.arg = node.arg.load(std::memory_order_relaxed);
+				uint64_t park = node.park_ms.load(std::memory_order_relaxed);
+				info.parked_ms = park && now > park ? now - park : 0;
+				infos.push_back(info);
+			}
+		}
+		std::sort(infos.begin(), infos.end(), [](const FiberInfo &a, const FiberInfo &b)
+				  { return a.parked_ms != b.parked_ms ? a.parked_ms > b.parked_ms : a.id < b.id; });
+		return infos;
+	}
+
+	static const char *StateName(int state)
+	{
+		switch (state)
+		{
+		case Fiber::READY:
+			return "READY";
+		case Fiber::RUNNING:
+			return "RUNNING";
+		case Fiber::SUSPENDED:
+			return "SUSPENDED";
+		case Fiber::RUNNABLE:
+			return "RUNNABLE";
+		case Fiber::TERM:
+			return "TERM";
+		default:
+			return "UNKNOWN";
+		}
+	}
+
+	static void DumpWait(std::ostream &os, const FiberRegistry::FiberInfo &info)
+	{
+		switch (info.reason)
+		{
+		case FiberRegistry::WAIT_IO:
+			os << "io fd=" << info.fd;
+			if (info.arg & IOManager::READ)
+			{
+				os << " READ";
+			}
+			if (info.arg & IOManager::WRITE)
+			{
+				os << " WRITE";
+			}
+			break;
+		case FiberRegistry::WAIT_TIMER:
+			os << "timer " << info.arg << "ms";
+			break;
+		case FiberRegistry::WAIT_SEMAPHORE:
+			os << "semaphore 0x" << std::hex << info.arg << std::dec;
+			break;
+		case FiberRegistry::WAIT_FUTURE:
+			os << "future 0x" << std::hex << info.arg << std::dec;
+			break;
+		default:
+			os << (info.main ? "main" : "-");
+			break;
+		}
+	}
+
+	void FiberRegistry::Dump(std::ostream &os)
+	{
+		std::vector<FiberInfo> infos = Snapshot();
+		size_t states[Fiber::TERM + 1] = {};
+		for (auto &info : infos)
+		{
+			if (info.state >= 0 && info.state <= Fiber::TERM)
+			{
+				states[info.state]++;
+			}
+		}
+
+		os << "FiberRegistry: " << infos.size() << " fibers (";
+		for (int i = 0; i <= Fiber::TERM; i++)
+		{
+			os << (i ? ", " : "") << StateName(i) << " " << states[i];
+		}
+		os << ")\n";
+		if (infos.empty())
+		{
+			return;
+		}
+
+		os << std::left << std::setw(10) << "id" << std::setw(11) << "state" << std::setw(10) << "thread"
+		   << std::setw(12) << "parked(ms)" << std::setw(10) << "stack" << "wait\n";
+		for (auto &info : infos)
+		{
+			os << std::setw(10) << info.id << std::setw(11) << StateName(info.state);
+			if (info.thread)
+			{
+				os << std::setw(10) << info.thread;
+			}
+			else
+			{
+				os << std::setw(10) << "-";
+			}
+			os << std::setw(12) << info.parked_ms << std::setw(10) << info.stacksize;
+			DumpWait(os, info);
+			os << "\n";
+		}
+		os << std::right;
+		os.flush();
+	}
+
+	// 信号处理函数中只能调用异步信号安全的函数 -> 直接用系统调用写管道, 绕过hook
+	static void DumpSignalHandler(int)
+	{
+		int saved = errno;
+		char c = 0;
+		syscall(SYS_write, s_dump_pipe[1], &c, 1);
+		errno = saved;
+	}
+
+	bool FiberRegistry::InstallSignalDump(int signo)
+	{
+		static std::mutex mutex;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (s_dump_pipe[0] >= 0)
+		{
+			return false;
+		}
+
+		if (pipe2(s_dump_pipe, O_CLOEXEC))
+		{
+			return false;
+		}
+		// 写端非阻塞 -> 管道写满时信号处理函数也不会阻塞(此时已有待输出的Dump)
+		fcntl(s_dump_pipe[1], F_SETFL, fcntl(s_dump_pipe[1], F_GETFL) | O_NONBLOCK);
+
+		SetEnabled(true);
+
+		// 后台线程不开启hook, read直接阻塞在管道上
+		int fd = s_dump_pipe[0];
+		new Thread([fd]()
+				   {
+			char buf[64];
+			while (true)
+			{
+				ssize_t n = read(fd, buf, sizeof(buf));
+				if (n > 0)
+				{
+					Dump(std::cerr);
+				}
+				else if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				else
+				{
+					break;
+				}
+			} }, "fiber_dump");
+
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = &DumpSignalHandler;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(signo, &sa, nullptr))
+		{
+			return false;
+		}
+		return true;
+	}
+
+} // namespace corlib
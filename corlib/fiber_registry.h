@@ -0,0 +1,102 @@
+#ifndef _FIBER_REGISTRY_H_
+#define _FIBER_REGISTRY_H_
+
+#include <stdint.h>
+#include <signal.h>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+namespace corlib
+{
+
+	class Fiber;
+
+	// 存活协程的注册表 -> 用于排查卡住的请求
+	// 默认关闭; 开启后新建的协程登记到注册表中, 并在挂起/恢复时记录所在线程、挂起原因和挂起时刻
+	// 关闭时每次切换只多一次原子变量的读取; 开启之前已创建的协程不会被登记
+	class FiberRegistry
+	{
+		friend class Fiber;
+	public:
+		// 挂起原因
+		enum WaitReason
+		{
+			// 没有标记原因的挂起(例如yield之后重新排队)
+			WAIT_NONE,
+			// 等待fd上的读/写事件
+			WAIT_IO,
+			// 等待定时器(sleep系列)
+			WAIT_TIMER,
+			// 等待FiberSemaphore
+			WAIT_SEMAPHORE,
+			// 等待Future的结果
+			WAIT_FUTURE
+		};
+
+		// 一个协程的快照
+		struct FiberInfo
+		{
+			uint64_t id = 0;
+			int state = 0;
+			// 最近一次运行所在的线程id, 还没有运行过为0
+			int thread = 0;
+			// 线程主协程或调度协程
+			bool main = false;
+			size_t stacksize = 0;
+			WaitReason reason = WAIT_NONE;
+			// WAIT_IO时为fd, 否则为-1
+			int fd = -1;
+			// WAIT_IO时为事件, WAIT_TIMER时为定时毫秒数, WAIT_SEMAPHORE/WAIT_FUTURE时为等待对象的地址
+			uint64_t arg = 0;
+			// 挂起至今的毫秒数, 没有挂起为0
+			uint64_t parked_ms = 0;
+		};
+
+		static void SetEnabled(bool enabled);
+		static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+		// 标记当前协程即将挂起的原因 -> 在挂起之前调用, 恢复运行时自动清除
+		static void SetWaitReason(WaitReason reason, int fd = -1, uint64_t arg = 0);
+
+		// 已登记的协程个数
+		static size_t GetCount();
+		// 所有已登记协程的快照, 按挂起时间从长到短排列
+		static std::vector<FiberInfo> Snapshot();
+		// 输出各状态的协程个数及每个协程的快照
+		static void Dump(std::ostream &os);
+
+		// 收到信号signo时把Dump输出到标准错误 -> 信号处理函数只写管道, 由后台线程输出
+		// 同时开启注册表; 只能安装一次, 失败返回false
+		static bool InstallSignalDump(int signo = SIGUSR2);
+
+	private:
+		static void Register(Fiber *fiber);
+		static void Unregister(Fiber *fiber);
+		// 协程挂起前/恢复后由Fiber调用
+		static void OnPark(Fiber *fiber);
+		static void OnResume(Fiber *fiber);
+
+	private:
+		static std::atomic<bool> s_enabled;
+	};
+
+	// 协程上的注册表节点和诊断信息, 内嵌在Fiber中
+	// 挂起原因等字段由协程自身写入、导出快照的线程读取 -> 使用relaxed原子变量
+	struct FiberRegistryNode
+	{
+		Fiber *prev = nullptr;
+		Fiber *next = nullptr;
+		// 所在的分片, 没有登记为-1
+		int shard = -1;
+		std::atomic<int> thread = {0};
+		std::atomic<int> reason = {FiberRegistry::WAIT_NONE};
+		std::atomic<int> fd = {-1};
+		std::atomic<uint64_t> arg = {0};
+		// 挂起时刻(单调时钟毫秒数), 没有挂起为0
+		std::atomic<uint64_t> park_ms = {0};
+	};
+
+} // namespace corlib
+
+#endif
@@ -0,0 +1,83 @@
+#include "future.h"
+#include "cancel.h"
+
+#include <system_error>
+
+namespace corlib
+{
+
+	namespace detail
+	{
+
+		int FutureStateBase::wait()
+		{
+			if (isReady())
+			{
+				return 0;
+			}
+
+			int err = CancelContext::Check();
+			if (err)
+			{
+				return err;
+			}
+
+			// 不在任务协程中 -> 阻塞线程
+			if (!Fiber::InTask() || !Scheduler::GetThis())
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this]()
+							{ return m_ready.load(std::memory_order_relaxed); });
+				return 0;
+			}
+
+			Fiber *self;
+			Scheduler *scheduler = Scheduler::GetThis();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_ready.load(std::memory_order_relaxed))
+				{
+					return 0;
+				}
+				m_waiters.emplace_back(scheduler, Fiber::GetThisRef());
+				self = m_waiters.back().second.get();
+				// 挂起期间调度器不能关闭 -> 唤醒方调用scheduleLock时调度器一定还在
+				scheduler->beginExternalWait();
+			}
+
+			// 超时/取消 -> 如果还在等待列表中则移出并唤醒, 已被取走说明结果已就绪
+			CancelWait cancel([this, self]()
+							  {
+				std::pair<Scheduler *, FiberRef> waiter;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					auto it = m_waiters.begin();
+					while (it != m_waiters.end() && it->second.get() != self)
+					{
+						++it;
+					}
+					if (it == m_waiters.end())
+					{
+						return false;
+					}
+					waiter = std::move(*it);
+					m_waiters.erase(it);
+				}
+				waiter.first->scheduleLock(&waiter.second);
+				return true; });
+
+			FiberRegistry::SetWaitReason(FiberRegistry::WAIT_FUTURE, -1, (uintptr_t)this);
+			Fiber::yieldToReady();
+			// 恢复后由自己减少: 此时本任务计入m_pendingTaskCount, 结束后所在线程会重新检查stopping()
+			scheduler->endExternalWait();
+			return cancel.finish();
+		}
+
+		void ThrowWaitError(int err)
+		{
+			throw std::system_error(err, std::generic_category(), "Future::get");
+		}
+
+	} // namespace detail
+
+} // namespace corlib
@@ -0,0 +1,247 @@
+#ifndef _FUTURE_H_
+#define _FUTURE_H_
+
+#include "scheduler.h"
+
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace corlib
+{
+
+	namespace detail
+	{
+
+		// Future/Promise共享的状态
+		// 在任务协程中等待时挂起协程(计入调度器的外部等待数, 调度器在它恢复之前不会关闭), 完成时通过等待者所在调度器的scheduleLock唤醒;
+		// 在普通线程(或主协程)中等待时退化为条件变量阻塞线程
+		class FutureStateBase
+		{
+		public:
+			bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+			// 等待完成, 返回0; 当前协程超过截止时间或被取消(见CancelContext)时返回ETIMEDOUT/ECANCELED
+			int wait();
+
+			void setException(std::exception_ptr exception)
+			{
+				complete([&]()
+						 { m_exception = exception; });
+			}
+
+		protected:
+			// 在锁内保存结果并标记完成, 然后唤醒所有等待者; 已经完成则返回false
+			template <class Store>
+			bool complete(Store &&store)
+			{
+				std::vector<std::pair<Scheduler *, FiberRef>> waiters;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (m_ready.load(std::memory_order_relaxed))
+					{
+						return false;
+					}
+					store();
+					m_ready.store(true, std::memory_order_release);
+					waiters.swap(m_waiters);
+				}
+				m_cond.notify_all();
+				for (auto &waiter : waiters)
+				{
+					waiter.first->scheduleLock(&waiter.second);
+				}
+				return true;
+			}
+
+			void rethrowIfFailed()
+			{
+				if (m_exception)
+				{
+					std::rethrow_exception(m_exception);
+				}
+			}
+
+		private:
+			std::mutex m_mutex;
+			std::condition_variable m_cond;
+			std::atomic<bool> m_ready = {false};
+			std::exception_ptr m_exception;
+			// 挂起等待的协程
+			std::vector<std::pair<Scheduler *, FiberRef>> m_waiters;
+		};
+
+		template <class T>
+		class FutureState : public FutureStateBase
+		{
+		public:
+			template <class U>
+			bool setValue(U &&value)
+			{
+				return complete([&]()
+								{ m_value.emplace(std::forward<U>(value)); });
+			}
+
+			T take()
+			{
+				rethrowIfFailed();
+				return std::move(*m_value);
+			}
+
+		private:
+			std::optional<T> m_value;
+		};
+
+		template <>
+		class FutureState<void> : public FutureStateBase
+		{
+		public:
+			bool setValue()
+			{
+				return complete([]() {});
+			}
+
+			void take()
+			{
+				rethrowIfFailed();
+			}
+		};
+
+		// 等待被超时/取消打断 -> get()抛出的异常
+		void ThrowWaitError(int err);
+
+	} // namespace detail
+
+	template <class T>
+	class Promise;
+
+	// 异步结果 -> 由Promise或async()得到, 可以在任意线程/协程中等待
+	template <class T>
+	class Future
+	{
+		friend class Promise<T>;
+	public:
+		Future() = default;
+
+		bool valid() const { return m_state != nullptr; }
+		bool isReady() const { return m_state && m_state->isReady(); }
+
+		// 挂起当前协程直到结果就绪, 返回0或ETIMEDOUT/ECANCELED
+		int wait() const { return m_state->wait(); }
+
+		// 等待并取出结果(或重新抛出异常), 之后Future不再有效
+		// 等待被超时/取消打断时抛出std::system_error
+		T get()
+		{
+			std::shared_ptr<detail::FutureState<T>> state;
+			state.swap(m_state);
+			int err = state->wait();
+			if (err)
+			{
+				m_state.swap(state);
+				detail::ThrowWaitError(err);
+			}
+			return state->take();
+		}
+
+	private:
+		explicit Future(std::shared_ptr<detail::FutureState<T>> state) : m_state(std::move(state)) {}
+
+	private:
+		std::shared_ptr<detail::FutureState<T>> m_state;
+	};
+
+	// 结果的生产方 -> 可以在任意线程设置结果, 析构时仍未设置则Future得到broken_promise异常
+	template <class T>
+	class Promise
+	{
+	public:
+		Promise() : m_state(std::make_shared<detail::FutureState<T>>()) {}
+		Promise(Promise &&other) = default;
+		Promise &operator=(Promise &&other) = default;
+		Promise(const Promise &) = delete;
+		Promise &operator=(const Promise &) = delete;
+
+		~Promise()
+		{
+			if (m_state && !m_state->isReady())
+			{
+				m_state->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+			}
+		}
+
+		Future<T> getFuture() { return Future<T>(m_state); }
+
+		template <class... Args>
+		void setValue(Args &&...args) { m_state->setValue(std::forward<Args>(args)...); }
+
+		void setException(std::exception_ptr exception) { m_state->setException(exception); }
+
+	private:
+		std::shared_ptr<detail::FutureState<T>> m_state;
+	};
+
+	namespace detail
+	{
+
+		template <class T, class F>
+		void FulfillPromise(Promise<T> &promise, F &f)
+		{
+			promise.setValue(f());
+		}
+
+		template <class F>
+		void FulfillPromise(Promise<void> &promise, F &f)
+		{
+			f();
+			promise.setValue();
+		}
+
+	} // namespace detail
+
+	// 把f作为任务投递到scheduler(为空则为当前线程的调度器)上执行, 返回其结果的Future
+	// 两者都没有(在普通线程中调用且没有指定调度器)时抛出std::logic_error
+	// f抛出的异常在Future::get()中重新抛出
+	template <class F>
+	Future<std::invoke_result_t<F>> async(Scheduler *scheduler, F f, int thread = -1)
+	{
+		typedef std::invoke_result_t<F> T;
+		if (!scheduler)
+		{
+			scheduler = Scheduler::GetThis();
+		}
+		if (!scheduler)
+		{
+			throw std::logic_error("async: no scheduler on this thread");
+		}
+
+		auto promise = std::make_shared<Promise<T>>();
+		Future<T> future = promise->getFuture();
+		scheduler->scheduleLock(std::function<void()>([promise, f]() mutable
+													  {
+			try
+			{
+				detail::FulfillPromise(*promise, f);
+			}
+			catch (...)
+			{
+				promise->setException(std::current_exception());
+			} }),
+								thread);
+		return future;
+	}
+
+	template <class F>
+	Future<std::invoke_result_t<F>> async(F f)
+	{
+		return corlib::async((Scheduler *)nullptr, std::move(f));
+	}
+
+} // namespace corlib
+
+#endif
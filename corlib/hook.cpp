@@ -4,6 +4,7 @@
 #include <iostream>
 #include <cstdarg> // 包含可变参数宏，如va_list等
 #include "fd_manager.h"
+#include "cancel.h"
 #include <string.h>
 
 // 将所有函数应用到HOOK_FUN宏
@@ -102,6 +103,9 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t
         return fun(fd, std::forward<Args>(args)...);
     }
 
+    // 安全点 -> 被看门狗要求让出的任务先让出再做I/O
+    corlib::Scheduler::PreemptPoint();
+
     // 获取文件描述符控制上下文
     std::shared_ptr<corlib::FdCtx> ctx = corlib::FdMgr::GetInstance()->get(fd);
     if (!ctx)
@@ -127,6 +131,14 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t
     std::shared_ptr<timer_info> tinfo(new timer_info); // 创建定时器信息结构体
 
 retry:
+    // 协程已超过截止时间或被取消 -> 不再发起I/O
+    int cancel_err = corlib::CancelContext::Check();
+    if (cancel_err)
+    {
+        errno = cancel_err;
+        return -1;
+    }
+
     // 调用原始函数
     ssize_t n = fun(fd, std::forward<Args>(args)...);
 
@@ -172,10 +184,15 @@ retry:
         }
         else
         {
-            corlib::Fiber::GetThis()->yield(); // 添加定时器后，当前协程让出执行权 去执行其他任务，直到事件发生或者定时器超时，定时器超时执行定时器任务（在定时器里取消事件，取消事件时会执行到这里一次）
+            // 协程的截止时间到达或被取消 -> 取消事件以唤醒本协程
+            corlib::CancelWait cancel([iom, fd, event]()
+                                      { return iom->cancelEvent(fd, (corlib::IOManager::Event)(event)); });
+            corlib::FiberRegistry::SetWaitReason(corlib::FiberRegistry::WAIT_IO, fd, event);
+            corlib::Fiber::yieldToReady(); // 添加定时器后，当前协程让出执行权 去执行其他任务，直到事件发生或者定时器超时，定时器超时执行定时器任务（在定时器里取消事件，取消事件时会执行到这里一次）
                                                // 或者正常执行（比如等待的数据到达）也会执行到这里，执行到这里后，会继续执行下面的代码
 
             // 恢复执行
+            int wait_err = cancel.finish();
             if (timer) // 如果定时器还没到时间就取消定时器
             {
                 timer->cancel(); // 取消定时器
@@ -185,12 +202,56 @@ retry:
                 errno = tinfo->cancelled;
                 return -1; // 定时器超时后，取消事件时会执行一次事件函数，也就会执行到这里，定时器超时返回-1
             }
+            if (wait_err) // 协程超过截止时间或被取消
+            {
+                errno = wait_err;
+                return -1;
+            }
             goto retry; // 比如：数据到了去读数据
         }
     } // 正常执行完库函数退出；
     return n;
 }
 
+// 挂起当前协程ms毫秒, 期间响应协程的截止时间和取消令牌, 返回0或ETIMEDOUT/ECANCELED
+static int do_sleep(uint64_t ms)
+{
+    int err = corlib::CancelContext::Check();
+    if (err)
+    {
+        return err;
+    }
+
+    corlib::IOManager *iom = corlib::IOManager::GetThis();
+    corlib::FiberRegistry::SetWaitReason(corlib::FiberRegistry::WAIT_TIMER, -1, ms);
+    if (!corlib::CancelContext::IsActive())
+    {
+        // 添加定时器以重新调度此协程，超时后会唤醒本协程加入任务队列中继续执行，继续点是yield之后
+        iom->addTimer(ms, [fiber = corlib::Fiber::GetThisRef(), iom]() mutable
+                      { iom->scheduleLock(&fiber, -1); });
+        corlib::Fiber::yieldToReady(); // 等待下次恢复
+        return 0;
+    }
+
+    // 定时器到期与超时/取消只能有一方唤醒本协程
+    auto woken = std::make_shared<std::atomic<bool>>(false);
+    auto wake = [fiber = corlib::Fiber::GetThisRef(), iom, woken]() mutable
+    {
+        if (woken->exchange(true))
+        {
+            return false;
+        }
+        iom->scheduleLock(&fiber, -1);
+        return true;
+    };
+    std::shared_ptr<corlib::Timer> timer = iom->addTimer(ms, [wake]() mutable
+                                                         { wake(); });
+    corlib::CancelWait cancel(wake);
+    corlib::Fiber::yieldToReady(); // 等待下次恢复
+    timer->cancel();
+    return cancel.finish();
+}
+
 extern "C"
 {
 
@@ -200,6 +261,7 @@ extern "C"
 #undef XX
 
     // 仅在任务协程中使用
+    // 协程超过截止时间或被取消时提前返回: sleep返回剩余秒数, usleep/nanosleep返回-1, errno为ETIMEDOUT/ECANCELED
     unsigned int sleep(unsigned int seconds)
     {
         if (!corlib::t_hook_enable)
@@ -207,13 +269,15 @@ extern "C"
             return sleep_f(seconds);
         }
 
-        std::shared_ptr<corlib::Fiber> fiber = corlib::Fiber::GetThis();
-        corlib::IOManager *iom = corlib::IOManager::GetThis();
-        // 添加定时器以重新调度此协程
-        iom->addTimer(seconds * 1000, [fiber, iom]()
-                      { iom->scheduleLock(fiber, -1); }); // 定时器处理函数就是本协程，也就是超时后会唤醒本协程加入任务队列中继续执行，这里继续点是yield之后，也就是退出sleep继续执行；
-                                                          // 这样让cpu跳过sleep时间，sleep时间去执行其他函数，定时器到了模拟sleep时间到了，唤醒本协程继续执行
-        fiber->yield();                                   // 等待下次恢复
+        // 这样让cpu跳过sleep时间，sleep时间去执行其他函数，定时器到了模拟sleep时间到了，唤醒本协程继续执行
+        uint64_t end = corlib::CancelContext::NowMS() + seconds * 1000ull;
+        int err = do_sleep(seconds * 1000ull);
+        if (err)
+        {
+            errno = err;
+            uint64_t now = corlib::CancelContext::NowMS();
+            return now < end ? (end - now + 999) / 1000 : 0;
+        }
 
         // 恢复时，任务队列处理时 下次恢复在这
         return 0;
@@ -226,12 +290,12 @@ extern "C"
             return usleep_f(usec);
         }
 
-        std::shared_ptr<corlib::Fiber> fiber = corlib::Fiber::GetThis();
-        corlib::IOManager *iom = corlib::IOManager::GetThis();
-        // 添加定时器以重新调度此协程
-        iom->addTimer(usec / 1000, [fiber, iom]()
-                      { iom->scheduleLock(fiber); });
-        fiber->yield(); // 等待下次恢复
+        int err = do_sleep(usec / 1000);
+        if (err)
+        {
+            errno = err;
+            return -1;
+        }
         return 0;
     }
 
@@ -242,14 +306,21 @@ extern "C"
             return nanosleep_f(req, rem);
         }
 
-        int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-
-        std::shared_ptr<corlib::Fiber> fiber = corlib::Fiber::GetThis();
-        corlib::IOManager *iom = corlib::IOManager::GetThis();
-        // 添加定时器以重新调度此协程
-        iom->addTimer(timeout_ms, [fiber, iom]()
-                      { iom->scheduleLock(fiber, -1); });
-        fiber->yield(); // 等待下次恢复
+        uint64_t timeout_ms = req->tv_sec * 1000ull + req->tv_nsec / 1000 / 1000;
+        uint64_t end = corlib::CancelContext::NowMS() + timeout_ms;
+        int err = do_sleep(timeout_ms);
+        if (err)
+        {
+            if (rem)
+            {
+                uint64_t now = corlib::CancelContext::NowMS();
+                uint64_t left = now < end ? end - now : 0;
+                rem->tv_sec = left / 1000;
+                rem->tv_nsec = (left % 1000) * 1000000;
+            }
+            errno = err;
+            return -1;
+        }
         return 0;
     }
 
@@ -304,6 +375,14 @@ extern "C"
             return connect_f(fd, addr, addrlen);
         }
 
+        // 协程已超过截止时间或被取消 -> 不再发起连接
+        int cancel_err = corlib::CancelContext::Check();
+        if (cancel_err)
+        {
+            errno = cancel_err;
+            return -1;
+        }
+
         // 尝试连接
         int n = connect_f(fd, addr, addrlen);
         if (n == 0)
@@ -340,10 +419,16 @@ extern "C"
         int rt = iom->addEvent(fd, corlib::IOManager::WRITE); //其实他之后才等待事件发生或者超时，上面只是注册回调函数
         if (rt == 0)
         {
+            // 协程的截止时间到达或被取消 -> 取消写事件以唤醒本协程
+            corlib::CancelWait cancel([iom, fd]()
+                                      { return iom->cancelEvent(fd, corlib::IOManager::WRITE); });
+
             // 当前协程让出执行权，等待事件发生
-            corlib::Fiber::GetThis()->yield(); // 退出，如果没有任务则进入idle等待事件发生或者超时
+            corlib::FiberRegistry::SetWaitReason(corlib::FiberRegistry::WAIT_IO, fd, corlib::IOManager::WRITE);
+            corlib::Fiber::yieldToReady(); // 退出，如果没有任务则进入idle等待事件发生或者超时
 
             // 恢复执行后，取消定时器（如果存在）
+            int wait_err = cancel.finish();
             if (timer)
             {
                 timer->cancel();
@@ -355,6 +440,11 @@ extern "C"
                 errno = tinfo->cancelled;
                 return -1;
             }
+            if (wait_err) // 协程超过截止时间或被取消
+            {
+                errno = wait_err;
+                return -1;
+            }
         }
         else
         {
@@ -1,9 +1,12 @@
-#include <unistd.h>    // for pipe, close, read, write
+#include <unistd.h>    // for close, read, write
 #include <sys/epoll.h> // for epoll_create, epoll_ctl, epoll_wait
 #include <fcntl.h>     // for fcntl
+#include <sys/eventfd.h> // for eventfd
 #include <cstring>     // for strerror
+#include <cstdlib>     // for abort
 
 #include "ioscheduler.h" // Custom header file for IOManager and related classes
+#include "cancel.h"
 
 static bool debug = false; // Debug flag
 
@@ -36,10 +39,12 @@ namespace corlib
         ctx.scheduler = nullptr;
         ctx.fiber.reset();
         ctx.cb = nullptr;
+        ctx.parked_at = 0;
+        ctx.priority = Scheduler::PRIORITY_NORMAL;
     }
 
     // 触发事件，不加锁
-    void IOManager::FdContext::triggerEvent(IOManager::Event event)
+    void IOManager::FdContext::triggerEvent(IOManager::Event event, ReadyTasks *ready)
     {
         assert(events & event);
 
@@ -48,15 +53,26 @@ namespace corlib
 
         // 触发事件
         EventContext &ctx = getEventContext(event);
-        if (ctx.cb)
+        if (ready && ctx.scheduler == ready->scheduler)
+        {
+            if (ctx.cb)
+            {
+                ready->cbs[ctx.priority].push_back(std::move(ctx.cb));
+            }
+            else
+            {
+                ready->fibers[ctx.priority].push_back(std::move(ctx.fiber));
+            }
+        }
+        else if (ctx.cb)
         {
             // 调用scheduleLock(std::function<void()>* f, int thr)
-            ctx.scheduler->scheduleLock(&ctx.cb);
+            ctx.scheduler->scheduleLock(&ctx.cb, -1, ctx.priority);
         }
         else
         {
-            // 调用scheduleLock(std::shared_ptr<Fiber>* f, int thr)
-            ctx.scheduler->scheduleLock(&ctx.fiber);
+            // 调用scheduleLock(FiberRef* f, int thr)
+            ctx.scheduler->scheduleLock(&ctx.fiber, -1, ctx.priority);
         }
 
         // 重置事件上下文
@@ -65,29 +81,29 @@ namespace corlib
     }
 
     // IOManager构造函数，初始化epoll和管道
-    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-        : Scheduler(threads, use_caller, name), TimerManager()
+    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, size_t min_threads)
+        : Scheduler(threads, use_caller, name, min_threads), TimerManager()
     {
         // 创建epoll文件描述符
         m_epfd = epoll_create(5000);
         assert(m_epfd > 0);
 
-        // 创建管道
-        int rt = pipe(m_tickleFds);
-        assert(!rt);
+        // 创建用于唤醒的eventfd(非阻塞)
+        m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(m_tickleFd >= 0);
 
         // 添加读事件到epoll
         epoll_event event;
         event.events = EPOLLIN | EPOLLET; // 边缘触发
-        event.data.fd = m_tickleFds[0];
-
-        // 设置非阻塞
-        rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-        assert(!rt);
+        event.data.fd = m_tickleFd;
 
         // 将读事件添加到epoll
-        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-        assert(!rt);
+        // 没有它空闲的线程无法被唤醒 -> 直接终止
+        if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event) != 0)
+        {
+            std::cerr << "IOManager::epoll_ctl(tickle fd) failed: " << strerror(errno) << std::endl;
+            abort();
+        }
 
         // 初始化上下文大小
         contextResize(32);
@@ -101,8 +117,7 @@ namespace corlib
     {
         stop();
         close(m_epfd);
-        close(m_tickleFds[0]);
-        close(m_tickleFds[1]);
+        close(m_tickleFd);
 
         for (size_t i = 0; i < m_fdContexts.size(); ++i)
         {
@@ -129,7 +144,7 @@ namespace corlib
     }
 
     // 添加事件
-    int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
+    int IOManager::addEvent(int fd, Event event, std::function<void()> cb, Priority priority)
     {
         // 尝试找到FdContext
         FdContext *fd_ctx = nullptr;
@@ -159,7 +174,7 @@ namespace corlib
         // 添加新事件
         int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
         epoll_event epevent;
-        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.events = EPOLLET | (int)(fd_ctx->events | event);
         epevent.data.ptr = fd_ctx;
 
         int rt = epoll_ctl(m_epfd, op, fd, &epevent);
@@ -178,14 +193,21 @@ namespace corlib
         FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
         assert(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
         event_ctx.scheduler = Scheduler::GetThis();
+        event_ctx.priority = priority;
         if (cb)
         {
             event_ctx.cb.swap(cb);
         }
         else
         {
-            event_ctx.fiber = Fiber::GetThis(); // 如果没有回调函数，那么就是回调函数就是当前协程
-            assert(event_ctx.fiber->getState() == Fiber::RUNNING);
+            event_ctx.fiber = Fiber::GetThisRef(); // 如果没有回调函数，那么就是回调函数就是当前协程
+            assert(event_ctx.fiber->getState() == Fiber::RUNNING || event_ctx.fiber->getState() == Fiber::RUNNABLE);
+            if (m_reclaimAfter.load(std::memory_order_relaxed))
+            {
+                event_ctx.parked_at = CancelContext::NowMS();
+                std::lock_guard<std::mutex> parked_lock(m_parkedMutex);
+                m_parked.push_back({fd_ctx, event, event_ctx.parked_at, 0});
+            }
         }
         return 0;
     }
@@ -220,7 +242,7 @@ namespace corlib
         Event new_events = (Event)(fd_ctx->events & ~event);
         int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
         epoll_event epevent;
-        epevent.events = EPOLLET | new_events;
+        epevent.events = EPOLLET | (int)new_events;
         epevent.data.ptr = fd_ctx;
 
         int rt = epoll_ctl(m_epfd, op, fd, &epevent);
@@ -271,7 +293,7 @@ namespace corlib
         Event new_events = (Event)(fd_ctx->events & ~event);
         int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
         epoll_event epevent;
-        epevent.events = EPOLLET | new_events;
+        epevent.events = EPOLLET | (int)new_events;
         epevent.data.ptr = fd_ctx;
 
         int rt = epoll_ctl(m_epfd, op, fd, &epevent);
@@ -344,16 +366,133 @@ namespace corlib
         return true;
     }
 
+    void IOManager::setStackReclaim(uint64_t parked_ms)
+    {
+        m_reclaimAfter = parked_ms;
+        if (!parked_ms)
+        {
+            std::lock_guard<std::mutex> lock(m_parkedMutex);
+            m_parked.clear();
+            m_parkedRetry.clear();
+        }
+        // 可能有空闲线程正阻塞在较长的超时上
+        tickle();
+    }
+
+    void IOManager::reclaimParkedStacks()
+    {
+        uint64_t threshold = m_reclaimAfter.load(std::memory_order_relaxed);
+        if (!threshold)
+        {
+            return;
+        }
+        // 同一时刻只有一个线程检查
+        uint64_t now = CancelContext::NowMS();
+        uint64_t last = m_lastReclaim.load(std::memory_order_relaxed);
+        if (now - last < threshold / 2 || !m_lastReclaim.compare_exchange_strong(last, now))
+        {
+            return;
+        }
+
+        // 取出到期的记录
+        std::vector<ParkedFiber> due;
+        {
+            std::lock_guard<std::mutex> lock(m_parkedMutex);
+            while (!m_parked.empty() && now - m_parked.front().parked_at >= threshold)
+            {
+                due.push_back(m_parked.front());
+                m_parked.pop_front();
+            }
+            while (!m_parkedRetry.empty() && m_parkedRetry.front().retry_at <= now)
+            {
+                due.push_back(m_parkedRetry.front());
+                m_parkedRetry.pop_front();
+            }
+        }
+
+        std::vector<ParkedFiber> retry;
+        for (ParkedFiber &item : due)
+        {
+            Scheduler *scheduler;
+            FiberRef fiber;
+            {
+                std::lock_guard<std::mutex> lock(item.fd_ctx->mutex);
+                FdContext::EventContext &ctx = item.fd_ctx->getEventContext(item.event);
+                // 这次挂起已经结束
+                if (!ctx.fiber || ctx.parked_at != item.parked_at)
+                {
+                    continue;
+                }
+                scheduler = ctx.scheduler;
+                fiber = ctx.fiber;
+            }
+
+            // 释放栈内存的系统调用在锁外进行
+            bool woken, again;
+            m_reclaimedBytes += fiber->reclaimStack(&woken, &again);
+            if (woken)
+            {
+                scheduler->scheduleLock(&fiber);
+            }
+            else if (again)
+            {
+                // 协程还在切出 -> 下一次检查时再试
+                item.retry_at = now + std::max(threshold / 2, (uint64_t)1);
+                retry.push_back(item);
+            }
+        }
+
+        if (!retry.empty())
+        {
+            std::lock_guard<std::mutex> lock(m_parkedMutex);
+            m_parkedRetry.insert(m_parkedRetry.end(), retry.begin(), retry.end());
+        }
+    }
+
     // 通知线程
     void IOManager::tickle()
     {
-        // 没有空闲线程
-        if (!hasIdleThreads())
+        // 没有空闲线程, 或者已有线程在寻找任务(它取到任务后如果还有任务会接力唤醒)
+        if (!hasIdleThreads() || hasSearchingThreads())
+        {
+            return;
+        }
+        // 优先唤醒停车的线程, 让等待I/O事件的线程继续等待
+        if (unparkWorker())
+        {
+            return;
+        }
+        wakePoller();
+    }
+
+    void IOManager::wakePoller()
+    {
+        if (m_pollerTickled.exchange(true))
+        {
+            return;
+        }
+        beginWakeup();
+        uint64_t one = 1;
+        // EAGAIN: 计数器已满, 说明还有未读的唤醒, poller一定会醒来
+        if (write(m_tickleFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        {
+            std::cerr << "wakePoller::write failed: " << strerror(errno) << std::endl;
+            abort();
+        }
+    }
+
+    // 唤醒指定的工作线程
+    void IOManager::tickleWorker(size_t worker)
+    {
+        if (unparkWorker(worker))
         {
             return;
         }
-        int rt = write(m_tickleFds[1], "T", 1);
-        assert(rt == 1);
+        // 它正在(或即将)等待I/O事件 -> 写eventfd; 否则它正在运行, 会在下一轮调度中看到信箱中的任务
+        if (m_poller == (int)worker)
+        {
+            wakePoller();
+        }
     }
 
     // 检查是否停止
@@ -369,6 +508,8 @@ namespace corlib
     {
         static const uint64_t MAX_EVENTS = 256;
         std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVENTS]);
+        ReadyTasks ready;
+        ready.scheduler = this;
 
         while (true)
         {
@@ -379,16 +520,56 @@ namespace corlib
             {
                 if (debug)
                     std::cout << "name = " << getName() << " idle exits in thread: " << Thread::GetThreadId() << std::endl;
+                // 依次唤醒其他空闲线程退出(不合并)
+                if (!unparkWorker())
+                {
+                    wakePoller();
+                }
                 break;
             }
 
+            // 已经有线程在等待I/O事件 -> 停车直到被唤醒, 然后回到调度循环取任务
+            static const uint64_t MAX_TIMEOUT = 5000;
+            int worker = getWorkerIndex();
+            int poller = -1;
+            if (!m_poller.compare_exchange_strong(poller, worker))
+            {
+                if (!parkWorker(MAX_TIMEOUT) && retireWorker())
+                {
+                    // 弹性线程池中空闲太久的线程退出 -> 不参与关闭时的接力唤醒
+                    return;
+                }
+                Fiber::GetThis()->yield();
+                continue;
+            }
+            // 成为等待者之后再检查一次 -> 投递任务后的唤醒要么看到本线程在等待, 要么任务在这里被看到
+            if (hasPendingTasks(worker))
+            {
+                m_poller = -1;
+                // 不再等待 -> 认领已经发出的唤醒并清空eventfd
+                if (m_pollerTickled.exchange(false))
+                {
+                    claimWakeup();
+                    uint64_t dummy;
+                    while (read(m_tickleFd, &dummy, sizeof(dummy)) > 0)
+                        ;
+                }
+                Fiber::GetThis()->yield();
+                continue;
+            }
+
             // 阻塞在epoll_wait
             int rt = 0;
             while (true)
             {
-                static const uint64_t MAX_TIMEOUT = 5000;
                 uint64_t next_timeout = getNextTimer();
                 next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+                // 开启了栈内存回收 -> 至少每隔检查间隔醒来一次
+                uint64_t reclaim = m_reclaimAfter.load(std::memory_order_relaxed);
+                if (reclaim)
+                {
+                    next_timeout = std::min(next_timeout, std::max(reclaim / 2, (uint64_t)1));
+                }
 
                 rt = epoll_wait(m_epfd, events.get(), MAX_EVENTS, (int)next_timeout);
                 // EINTR -> 重试
@@ -401,30 +582,28 @@ namespace corlib
                     break;
                 }
             };
-W
-            // 收集所有过期的定时器
-            std::vector<std::functiWon<void()>> cbs;
-            listExpiredCb(cbs);
-            if (!cbs.empty())
+
+            m_poller = -1;
+            // 认领被tickle的唤醒 -> 取过任务之后才释放, 期间的tickle被合并
+            if (m_pollerTickled.exchange(false))
             {
-                for (const auto &cb : cbs)
-                {
-                    scheduleLock(cb);
-                }
-                cbs.clear();
+                claimWakeup();
             }
 
+            // 收集所有过期的定时器
+            listExpiredCb(ready.cbs, PRIORITY_COUNT);
+
             // 收集所有准备好的事件
             for (int i = 0; i < rt; ++i)
             {
                 epoll_event &event = events[i];
 
                 // 处理tickle事件
-                if (event.data.fd == m_tickleFds[0])
+                if (event.data.fd == m_tickleFd)
                 {
-                    uint8_t dummy[256];
-                    // 边缘触发 -> 耗尽
-                    while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
+                    // 一次读取就清零计数
+                    uint64_t dummy;
+                    while (read(m_tickleFd, &dummy, sizeof(dummy)) > 0)
                         ;
                     continue;
                 }
@@ -469,16 +648,46 @@ W
                 // 调度回调并更新FdContext和事件上下文
                 if (real_events & READ)
                 {
-                    fd_ctx->triggerEvent(READ);
+                    fd_ctx->triggerEvent(READ, &ready);
                     --m_pendingEventCount;
                 }
                 if (real_events & WRITE)
                 {
-                    fd_ctx->triggerEvent(WRITE);
+                    fd_ctx->triggerEvent(WRITE, &ready);
                     --m_pendingEventCount;
                 }
             } // 结束 for
 
+            // 接下来要运行就绪的任务 -> 唤醒一个停车的线程接替等待I/O事件(已有线程在寻找任务时由它接替)
+            bool busy = false;
+            for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+            {
+                busy = busy || !ready.cbs[priority].empty() || !ready.fibers[priority].empty();
+            }
+            if (busy && !hasSearchingThreads())
+            {
+                unparkWorker();
+            }
+
+            // 过期定时器的回调和就绪的协程批量投递 -> 每类只加一次锁、最多唤醒一次; 高优先级先投递
+            for (int priority = PRIORITY_COUNT - 1; priority >= 0; priority--)
+            {
+                std::vector<std::function<void()>> &cbs = ready.cbs[priority];
+                if (!cbs.empty())
+                {
+                    scheduleBatch(cbs.begin(), cbs.end(), (Priority)priority);
+                    cbs.clear();
+                }
+                std::vector<FiberRef> &fibers = ready.fibers[priority];
+                if (!fibers.empty())
+                {
+                    scheduleBatch(fibers.begin(), fibers.end(), (Priority)priority);
+                    fibers.clear();
+                }
+            }
+
+            reclaimParkedStacks();
+
             Fiber::GetThis()->yield();
 
         } // 结束 while(true)
@@ -487,7 +696,11 @@ W
     // 当定时器插入到队列前端时调用
     void IOManager::onTimerInsertedAtFront()
     {
-        tickle();
+        // 只有等待I/O事件的线程需要按新的超时时间重新等待; 没有等待者时下一个等待者会读到新的超时时间
+        if (m_poller != -1)
+        {
+            wakePoller();
+        }
     }
 
 } // end namespace corlib
@@ -4,6 +4,8 @@
 #include "scheduler.h"
 #include "timer.h"
 
+#include <deque>
+
 namespace corlib
 {
 
@@ -21,6 +23,15 @@ namespace corlib
         };
 
     private:
+        // 一轮epoll_wait中就绪的本调度器的任务 -> 处理完所有事件后批量投递
+        struct ReadyTasks
+        {
+            Scheduler *scheduler = nullptr;
+            // 按优先级分开
+            std::vector<FiberRef> fibers[PRIORITY_COUNT];
+            std::vector<std::function<void()>> cbs[PRIORITY_COUNT];
+        };
+
         // 文件描述符上下文
         struct FdContext
         {
@@ -30,9 +41,13 @@ namespace corlib
                 // 调度器
                 Scheduler *scheduler = nullptr;
                 // 回调协程
-                std::shared_ptr<Fiber> fiber;
+                FiberRef fiber;
                 // 回调函数
                 std::function<void()> cb;
+                // 协程开始挂起等待的时刻(毫秒), 0表示不需要回收栈内存
+                uint64_t parked_at = 0;
+                // 事件就绪后回调/协程的调度优先级
+                Priority priority = PRIORITY_NORMAL;
             };
 
             // 读事件上下文
@@ -50,18 +65,18 @@ namespace corlib
             EventContext &getEventContext(Event event);
             // 重置事件上下文
             void resetEventContext(EventContext &ctx);
-            // 触发事件
-            void triggerEvent(Event event);
+            // 触发事件 -> ready不为空时本调度器的任务先收集到ready中, 由调用者批量投递
+            void triggerEvent(Event event, ReadyTasks *ready = nullptr);
         };
 
     public:
-        // 构造函数
-        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+        // 构造函数, min_threads不为0时为弹性线程池(见Scheduler)
+        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager", size_t min_threads = 0);
         // 析构函数
         ~IOManager();
 
-        // 添加事件
-        int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+        // 添加事件 -> 事件就绪后以priority调度回调(或当前协程)
+        int addEvent(int fd, Event event, std::function<void()> cb = nullptr, Priority priority = PRIORITY_NORMAL);
         // 删除事件
         bool delEvent(int fd, Event event);
         // 取消事件并触发其回调
@@ -69,12 +84,23 @@ namespace corlib
         // 取消所有事件并触发其回调
         bool cancelAll(int fd);
 
+        // 在fd上挂起等待超过parked_ms毫秒的协程, 释放其栈上未使用部分的物理页(见Fiber::reclaimStack), 0表示关闭(默认)
+        // 适合大量长时间空闲的长连接; 检查在空闲协程中周期性进行, 间隔为parked_ms的一半
+        void setStackReclaim(uint64_t parked_ms);
+        uint64_t getStackReclaim() const { return m_reclaimAfter.load(std::memory_order_relaxed); }
+        // 累计释放的栈内存字节数
+        uint64_t getReclaimedStackBytes() const { return m_reclaimedBytes.load(std::memory_order_relaxed); }
+
         // 获取当前 IOManager 实例，在任何时候都可以调用，返回当前线程的 IOManager 实例
         static IOManager *GetThis();
 
     protected:
-        // 唤醒调度器
+        // 唤醒调度器 -> 已有线程在寻找任务时合并; 否则优先唤醒一个停车的线程, 没有则唤醒等待I/O事件的线程
         void tickle() override;
+        // 唤醒指定的工作线程
+        void tickleWorker(size_t worker) override;
+        // 唤醒阻塞在epoll_wait的线程, 它醒来之前的重复唤醒被合并
+        void wakePoller();
 
         // 判断是否可以停止
         bool stopping() override;
@@ -88,17 +114,45 @@ namespace corlib
         // 调整上下文大小
         void contextResize(size_t size);
 
+        // 回收挂起时间超过阈值的协程栈, 距离上一次检查不足间隔时直接返回
+        void reclaimParkedStacks();
+
+    private:
+        // 一次等待栈回收的挂起 -> (fd_ctx, event, parked_at)与事件上下文中的值一致时这次挂起还没有结束
+        struct ParkedFiber
+        {
+            FdContext *fd_ctx;
+            Event event;
+            uint64_t parked_at;
+            // 重试的时刻
+            uint64_t retry_at;
+        };
+
     private:
         // epoll 文件描述符
         int m_epfd = 0;
-        // 管道文件描述符，fd[0] 读，fd[1] 写
-        int m_tickleFds[2];
+        // eventfd -> 唤醒阻塞在epoll_wait的线程
+        int m_tickleFd = -1;
+        // 已经写过eventfd而等待者还没有醒来 -> 不再重复写
+        std::atomic<bool> m_pollerTickled = {false};
+        // 阻塞在epoll_wait的工作线程下标, -1表示没有 -> 同一时刻只有一个空闲线程等待I/O事件, 其他空闲线程停车
+        std::atomic<int> m_poller = {-1};
         // 挂起事件计数
         std::atomic<size_t> m_pendingEventCount = {0};
         // 共享互斥锁
         std::shared_mutex m_mutex;
         // 存储每个文件描述符的上下文
         std::vector<FdContext *> m_fdContexts;
+        // 栈内存回收的挂起时间阈值, 0表示关闭
+        std::atomic<uint64_t> m_reclaimAfter = {0};
+        // 上一次检查的时刻
+        std::atomic<uint64_t> m_lastReclaim = {0};
+        // 开启回收时挂起的协程, 按parked_at先后排列 -> 检查只访问到期的记录, 不遍历整个fd表
+        // 已经恢复的记录到期时才丢弃; m_parkedRetry为回收时还没切出完成的协程, 按retry_at先后排列
+        std::mutex m_parkedMutex;
+        std::deque<ParkedFiber> m_parked;
+        std::deque<ParkedFiber> m_parkedRetry;
+        std::atomic<uint64_t> m_reclaimedBytes = {0};
     };
 
 } // end namespace corlib
@@ -1,31 +1,10 @@
 #include "mutex.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "cancel.h"
 
 namespace corlib {
 
-Semaphore::Semaphore(uint32_t count) {
-    if(sem_init(&m_semaphore, 0, count)) {
-        throw std::logic_error("sem_init error");
-    }
-}
-
-Semaphore::~Semaphore() {
-    sem_destroy(&m_semaphore);
-}
-
-void Semaphore::wait() {
-    if(sem_wait(&m_semaphore)) {
-        throw std::logic_error("sem_wait error");
-    }
-}
-
-void Semaphore::notify() {
-    if(sem_post(&m_semaphore)) {
-        throw std::logic_error("sem_post error");
-    }
-}
-
 FiberSemaphore::FiberSemaphore(size_t initial_concurrency)
     :m_concurrency(initial_concurrency) {
 }
@@ -46,25 +25,46 @@ bool FiberSemaphore::tryWait() {
     }
 }
 
-void FiberSemaphore::wait() {
+int FiberSemaphore::wait() {
     CORLIB_ASSERT(Scheduler::GetThis());
+    int err = CancelContext::Check();
+    if(err) {
+        return err;
+    }
+    Fiber* self;
     {
         MutexType::Lock lock(m_mutex);
         if(m_concurrency > 0u) {
             --m_concurrency;
-            return;
+            return 0;
         }
-        m_waiters.push_back(std::make_pair(Scheduler::GetThis(), Fiber::GetThis()));
+        m_waiters.push_back(std::make_pair(Scheduler::GetThis(), Fiber::GetThisRef()));
+        self = m_waiters.back().second.get();
     }
+    // 超时/取消 -> 如果还在等待队列中则移出并唤醒, 已被notify取走则说明已获得信号量
+    CancelWait cancel([this, self]() {
+        MutexType::Lock lock(m_mutex);
+        for(auto it = m_waiters.begin(); it != m_waiters.end(); ++it) {
+            if(it->second.get() == self) {
+                auto waiter = std::move(*it);
+                m_waiters.erase(it);
+                waiter.first->scheduleLock(&waiter.second);
+                return true;
+            }
+        }
+        return false;
+    });
+    FiberRegistry::SetWaitReason(FiberRegistry::WAIT_SEMAPHORE, -1, (uintptr_t)this);
     Fiber::yieldToReady();
+    return cancel.finish();
 }
 
 void FiberSemaphore::notify() {
     MutexType::Lock lock(m_mutex);
     if(!m_waiters.empty()) {
-        auto next = m_waiters.front();
+        auto next = std::move(m_waiters.front());
         m_waiters.pop_front();
-        next.first->scheduleLock(next.second);
+        next.first->scheduleLock(&next.second);
     } else {
         ++m_concurrency;
     }
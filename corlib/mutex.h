@@ -12,38 +12,10 @@
 
 #include "noncopyable.h"
 #include "fiber.h"
+#include "thread.h"
 
 namespace corlib {
 
-/**
- *  信号量
- */
-class Semaphore : Noncopyable {
-public:
-    /**
-     *  构造函数
-     * @param[in] count 信号量值的大小
-     */
-    Semaphore(uint32_t count = 0);
-
-    /**
-     *  析构函数
-     */
-    ~Semaphore();
-
-    /**
-     *  获取信号量
-     */
-    void wait();
-
-    /**
-     *  释放信号量
-     */
-    void notify();
-private:
-    sem_t m_semaphore;
-};
-
 /**
  *  局部锁的模板实现
  */
@@ -433,14 +405,15 @@ public:
     ~FiberSemaphore();
 
     bool tryWait();
-    void wait();
+    // 返回0表示获得信号量; 当前协程超过截止时间或被取消(见CancelContext)时返回ETIMEDOUT/ECANCELED
+    int wait();
     void notify();
 
     size_t getConcurrency() const { return m_concurrency;}
     void reset() { m_concurrency = 0;}
 private:
     MutexType m_mutex;
-    std::list<std::pair<Scheduler*, Fiber::ptr> > m_waiters;
+    std::list<std::pair<Scheduler*, FiberRef> > m_waiters;
     size_t m_concurrency;
 };
 
@@ -0,0 +1,211 @@
+#include "numa.h"
+#include "stack_allocator.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+
+// 内存策略常量(与<numaif.h>一致, 不依赖libnuma的头文件)
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT 0
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+namespace corlib
+{
+
+	// 节点掩码支持的最大节点数
+	static const int kMaxNodes = 1024;
+
+	struct Topology
+	{
+		std::vector<int> nodes;
+		std::vector<std::vector<int>> node_cpus; // 按节点编号索引
+		std::vector<int> cpu_node;				 // 按CPU编号索引
+
+		Topology()
+		{
+			DIR *dir = opendir("/sys/devices/system/node");
+			if (dir)
+			{
+				while (dirent *entry = readdir(dir))
+				{
+					if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit(entry->d_name[4]))
+					{
+						continue;
+					}
+					int node = atoi(entry->d_name + 4);
+					std::ifstream in(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+					std::string list;
+					std::getline(in, list);
+					add(node, Numa::ParseCpuList(list));
+				}
+				closedir(dir);
+			}
+
+			// 没有NUMA信息 -> 所有CPU都在节点0上
+			if (nodes.empty())
+			{
+				std::vector<int> cpus;
+				long count = sysconf(_SC_NPROCESSORS_CONF);
+				for (long i = 0; i < count; i++)
+				{
+					cpus.push_back(i);
+				}
+				add(0, cpus);
+			}
+			std::sort(nodes.begin(), nodes.end());
+		}
+
+		void add(int node, const std::vector<int> &cpus)
+		{
+			// 只有内存没有CPU的节点不用于放置工作线程
+			if (node < 0 || node >= kMaxNodes || cpus.empty())
+			{
+				return;
+			}
+			nodes.push_back(node);
+			if ((int)node_cpus.size() <= node)
+			{
+				node_cpus.resize(node + 1);
+			}
+			node_cpus[node] = cpus;
+			for (int cpu : cpus)
+			{
+				if ((int)cpu_node.size() <= cpu)
+				{
+					cpu_node.resize(cpu + 1, -1);
+				}
+				cpu_node[cpu] = node;
+			}
+		}
+
+		static const Topology &GetInstance()
+		{
+			static Topology topology;
+			return topology;
+		}
+	};
+
+	const std::vector<int> &Numa::Nodes()
+	{
+		return Topology::GetInstance().nodes;
+	}
+
+	const std::vector<int> &Numa::NodeCpus(int node)
+	{
+		static const std::vector<int> empty;
+		const Topology &topology = Topology::GetInstance();
+		if (node < 0 || node >= (int)topology.node_cpus.size())
+		{
+			return empty;
+		}
+		return topology.node_cpus[node];
+	}
+
+	int Numa::CpuNode(int cpu)
+	{
+		const Topology &topology = Topology::GetInstance();
+		if (cpu < 0 || cpu >= (int)topology.cpu_node.size())
+		{
+			return -1;
+		}
+		return topology.cpu_node[cpu];
+	}
+
+	std::vector<int> Numa::ParseCpuList(const std::string &list)
+	{
+		std::vector<int> cpus;
+		const char *p = list.c_str();
+		while (*p)
+		{
+			if (!isdigit(*p))
+			{
+				p++;
+				continue;
+			}
+			char *end;
+			int first = strtol(p, &end, 10);
+			int last = first;
+			if (*end == '-')
+			{
+				last = strtol(end + 1, &end, 10);
+			}
+			for (int cpu = first; cpu <= last; cpu++)
+			{
+				cpus.push_back(cpu);
+			}
+			p = end;
+		}
+		return cpus;
+	}
+
+	bool Numa::SetThreadAffinity(pid_t tid, const std::vector<int> &cpus)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (cpus.empty())
+		{
+			long count = sysconf(_SC_NPROCESSORS_CONF);
+			for (long i = 0; i < count && i < CPU_SETSIZE; i++)
+			{
+				CPU_SET(i, &set);
+			}
+		}
+		for (int cpu : cpus)
+		{
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+		return sched_setaffinity(tid, sizeof(set), &set) == 0;
+	}
+
+	bool Numa::SetPreferredNode(int node)
+	{
+		if (node < 0)
+		{
+			return syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0) == 0;
+		}
+		if (node >= kMaxNodes)
+		{
+			return false;
+		}
+		unsigned long mask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+		mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+		// 内核只使用maxnode - 1位
+		return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, kMaxNodes + 1) == 0;
+	}
+
+	bool Numa::MoveToNode(const void *addr, size_t len, int node)
+	{
+		if (node < 0 || len == 0)
+		{
+			return false;
+		}
+		size_t page = StackAllocator::PageSize();
+		uintptr_t begin = (uintptr_t)addr & ~(page - 1);
+		uintptr_t end = (uintptr_t)addr + len;
+		std::vector<void *> pages;
+		for (uintptr_t p = begin; p < end; p += page)
+		{
+			pages.push_back((void *)p);
+		}
+		std::vector<int> nodes(pages.size(), node);
+		std::vector<int> status(pages.size());
+		return syscall(SYS_move_pages, 0, pages.size(), pages.data(), nodes.data(), status.data(), MPOL_MF_MOVE) == 0;
+	}
+
+} // namespace corlib
@@ -0,0 +1,38 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <stddef.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace corlib
+{
+
+	// CPU/NUMA拓扑和线程放置
+	// 拓扑从/sys/devices/system/node读取, 读不到时视为只有一个节点0包含所有CPU
+	// 内存策略直接使用系统调用, 不依赖libnuma; 内核不支持NUMA时相关操作返回false, 不影响正确性
+	class Numa
+	{
+	public:
+		// 有CPU的节点编号(升序)
+		static const std::vector<int> &Nodes();
+		// 节点上的CPU, 节点不存在返回空
+		static const std::vector<int> &NodeCpus(int node);
+		// CPU所在的节点, 未知返回-1
+		static int CpuNode(int cpu);
+
+		// 解析"0-3,8,10-11"格式的CPU列表
+		static std::vector<int> ParseCpuList(const std::string &list);
+
+		// 把线程tid(0表示当前线程)绑定到cpus上, cpus为空表示允许在所有CPU上运行
+		static bool SetThreadAffinity(pid_t tid, const std::vector<int> &cpus);
+		// 当前线程之后新分配的物理页优先放在node上, node为-1恢复默认策略
+		static bool SetPreferredNode(int node);
+		// 把[addr, addr + len)所在的页迁移到node上(以页为单位, 可能连带迁移同一页中的其他数据)
+		static bool MoveToNode(const void *addr, size_t len, int node);
+	};
+
+} // namespace corlib
+
+#endif
@@ -0,0 +1,137 @@
+#include "offload.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+namespace corlib
+{
+
+	static uint64_t NowNS()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	OffloadPool::OffloadPool(size_t max_threads, const std::string &name, size_t max_queued)
+		: m_name(name), m_maxThreads(max_threads), m_maxQueueDepth(max_queued)
+	{
+		assert(max_threads > 0);
+	}
+
+	OffloadPool::~OffloadPool()
+	{
+		std::vector<std::shared_ptr<Thread>> threads;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+			threads.swap(m_threads);
+		}
+		m_cond.notify_all();
+		for (auto &thread : threads)
+		{
+			thread->join();
+		}
+	}
+
+	bool OffloadPool::post(std::function<void()> job)
+	{
+		if (!job)
+		{
+			errno = EINVAL;
+			return false;
+		}
+		Job item;
+		item.fn.swap(job);
+		item.enqueued = NowNS();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_stopping)
+		{
+			errno = ESHUTDOWN;
+			return false;
+		}
+		if (m_maxQueueDepth && m_jobs.size() >= m_maxQueueDepth)
+		{
+			m_rejected++;
+			errno = EAGAIN;
+			return false;
+		}
+		m_jobs.push(std::move(item));
+		m_maxQueued = std::max(m_maxQueued, m_jobs.size());
+		// 空闲线程不够取走排队的任务 -> 创建新线程(不开启hook, 阻塞调用直接阻塞该线程)
+		if (m_idleThreads < m_jobs.size() && m_threads.size() < m_maxThreads)
+		{
+			m_threads.emplace_back(new Thread(std::bind(&OffloadPool::run, this), m_name + "_" + std::to_string(m_threads.size())));
+		}
+		else
+		{
+			m_cond.notify_one();
+		}
+		return true;
+	}
+
+	void OffloadPool::run()
+	{
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				while (m_jobs.empty() && !m_stopping)
+				{
+					m_idleThreads++;
+					m_cond.wait(lock);
+					m_idleThreads--;
+				}
+				// 关闭时先运行完已经投递的任务
+				if (!m_jobs.pop(job))
+				{
+					return;
+				}
+			}
+
+			uint64_t start = NowNS();
+			m_queueDelay.record(start > job.enqueued ? start - job.enqueued : 0);
+			job.fn();
+			// 在本线程上释放任务捕获的资源
+			job.fn = nullptr;
+			m_runTime.record(NowNS() - start);
+			m_completed++;
+		}
+	}
+
+	OffloadPool::Stats OffloadPool::getStats() const
+	{
+		Stats stats;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			stats.threads = m_threads.size();
+			stats.queued = m_jobs.size();
+			stats.max_queued = m_maxQueued;
+		}
+		stats.completed = m_completed;
+		stats.rejected = m_rejected;
+		stats.queue_delay = m_queueDelay.stats();
+		stats.run_time = m_runTime.stats();
+		return stats;
+	}
+
+	void OffloadPool::resetStats()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_maxQueued = m_jobs.size();
+		}
+		m_queueDelay.reset();
+		m_runTime.reset();
+	}
+
+	OffloadPool &OffloadPool::GetDefault()
+	{
+		// 不析构 -> 进程退出时不等待仍阻塞着的任务
+		static OffloadPool *pool = new OffloadPool(std::max(4u, std::thread::hardware_concurrency()), "offload");
+		return *pool;
+	}
+
+} // namespace corlib
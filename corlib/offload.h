@@ -0,0 +1,136 @@
+#ifndef _OFFLOAD_H_
+#define _OFFLOAD_H_
+
+#include "future.h"
+#include "noncopyable.h"
+#include "ring_buffer.h"
+#include "thread.h"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace corlib
+{
+
+	// 阻塞任务线程池 -> 运行无法通过hook变为非阻塞的调用(fsync、getaddrinfo、普通文件的open/stat、压缩等计算密集的任务)
+	// 线程不开启hook, 按需创建, 最多max_threads个; 任务先进先出
+	// 排队的任务最多max_queued个(0表示不限), 队列已满时投递立即失败而不是阻塞调用者 -> 调用者自行决定重试、降级还是放弃
+	class OffloadPool : Noncopyable
+	{
+	public:
+		struct Stats
+		{
+			// 已创建的线程数
+			size_t threads = 0;
+			// 排队中的任务数及其最大值
+			size_t queued = 0;
+			size_t max_queued = 0;
+			uint64_t completed = 0;
+			// 因队列已满被拒绝的任务数
+			uint64_t rejected = 0;
+			// 入队到开始运行的延迟、运行耗时
+			Scheduler::QueueDelayStats queue_delay;
+			Scheduler::QueueDelayStats run_time;
+		};
+
+		explicit OffloadPool(size_t max_threads, const std::string &name = "offload", size_t max_queued = 0);
+		// 运行完已经投递的任务后结束所有线程
+		~OffloadPool();
+
+		// 投递任务(不应抛出异常), 失败返回false并设置errno: 队列已满为EAGAIN, 已经关闭为ESHUTDOWN, job为空为EINVAL
+		bool post(std::function<void()> job);
+
+		// 投递f, 返回其结果的Future; f抛出的异常在Future::get()中重新抛出
+		// 投递失败时Future::get()抛出std::system_error(错误码同post)
+		template <class F>
+		Future<std::invoke_result_t<F>> submit(F f)
+		{
+			typedef std::invoke_result_t<F> T;
+			auto promise = std::make_shared<Promise<T>>();
+			Future<T> future = promise->getFuture();
+			if (!post([promise, f]() mutable
+					  {
+				try
+				{
+					detail::FulfillPromise(*promise, f);
+				}
+				catch (...)
+				{
+					promise->setException(std::current_exception());
+				} }))
+			{
+				promise->setException(std::make_exception_ptr(std::system_error(errno, std::generic_category(), "offload")));
+			}
+			return future;
+		}
+
+		size_t getMaxThreads() const { return m_maxThreads; }
+		size_t getMaxQueueDepth() const { return m_maxQueueDepth; }
+		Stats getStats() const;
+		// 清零排队任务数的最大值和延迟统计
+		void resetStats();
+
+		// 进程默认的线程池(max(4, CPU数)个线程), 第一次使用时创建, 进程退出时不等待
+		static OffloadPool &GetDefault();
+
+	private:
+		struct Job
+		{
+			std::function<void()> fn;
+			// 入队时刻(单调时钟纳秒)
+			uint64_t enqueued = 0;
+		};
+
+		// 线程函数
+		void run();
+
+	private:
+		std::string m_name;
+		size_t m_maxThreads;
+		// 排队任务数上限, 0表示不限
+		size_t m_maxQueueDepth;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_cond;
+		// 以下由m_mutex保护
+		RingBuffer<Job> m_jobs;
+		std::vector<std::shared_ptr<Thread>> m_threads;
+		size_t m_idleThreads = 0;
+		size_t m_maxQueued = 0;
+		bool m_stopping = false;
+		std::atomic<uint64_t> m_completed = {0};
+		std::atomic<uint64_t> m_rejected = {0};
+		Scheduler::DelayHistogram m_queueDelay;
+		Scheduler::DelayHistogram m_runTime;
+	};
+
+	// 在阻塞任务线程池pool(为空则为OffloadPool::GetDefault())上运行f并返回其结果, f抛出的异常重新抛出
+	// 在任务协程中调用时只挂起当前协程, 结果就绪后在它的调度器上恢复; 在普通线程中调用时阻塞线程
+	// 等待被超时/取消(见CancelContext)打断时抛出std::system_error, 但f仍会运行完 -> f应当按值捕获
+	// 线程池队列已满(EAGAIN)或已经关闭(ESHUTDOWN)时f不会运行, 同样抛出std::system_error
+	template <class F>
+	std::invoke_result_t<F> offload(OffloadPool *pool, F f)
+	{
+		if (!pool)
+		{
+			pool = &OffloadPool::GetDefault();
+		}
+		return pool->submit(std::move(f)).get();
+	}
+
+	template <class F>
+	std::invoke_result_t<F> offload(F f)
+	{
+		return corlib::offload((OffloadPool *)nullptr, std::move(f));
+	}
+
+} // namespace corlib
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+namespace corlib
+{
+
+	// 先进先出的环形缓冲区, 入队/出队都是O(1), 容量不足时翻倍
+	// 不是线程安全的, 由使用者加锁
+	template <class T>
+	class RingBuffer
+	{
+	public:
+		explicit RingBuffer(size_t capacity = 64)
+		{
+			size_t size = 1;
+			while (size < capacity)
+			{
+				size <<= 1;
+			}
+			m_items.resize(size);
+		}
+
+		bool empty() const { return m_size == 0; }
+		size_t size() const { return m_size; }
+
+		void push(T &&item)
+		{
+			if (m_size == m_items.size())
+			{
+				resize(m_items.size() * 2);
+			}
+			m_items[(m_head + m_size) & (m_items.size() - 1)] = std::move(item);
+			m_size++;
+		}
+
+		// 取出最早入队的元素, 为空返回false
+		bool pop(T &item)
+		{
+			if (m_size == 0)
+			{
+				return false;
+			}
+			T &slot = m_items[m_head];
+			item = std::move(slot);
+			// 清空槽位 -> 及时释放元素持有的资源
+			slot = T();
+			m_head = (m_head + 1) & (m_items.size() - 1);
+			m_size--;
+			return true;
+		}
+
+		// 重新分配同样大小的存储 -> 新存储从调用线程当前的内存策略(NUMA节点)分配
+		void relocate()
+		{
+			resize(m_items.size());
+		}
+
+	private:
+		void resize(size_t capacity)
+		{
+			std::vector<T> items(capacity);
+			for (size_t i = 0; i < m_size; i++)
+			{
+				items[i] = std::move(m_items[(m_head + i) & (m_items.size() - 1)]);
+			}
+			m_items.swap(items);
+			m_head = 0;
+		}
+
+	private:
+		std::vector<T> m_items;
+		size_t m_head = 0;
+		size_t m_size = 0;
+	};
+
+} // namespace corlib
+
+#endif
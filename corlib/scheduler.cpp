@@ -1,4 +1,17 @@
 #include "scheduler.h"
+#include "numa.h"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
 
 static bool debug = false; // 是否启用调试
 
@@ -6,6 +19,63 @@ namespace corlib
 {
 
 	static thread_local Scheduler *t_scheduler = nullptr; // 当前线程上的调度器指针
+	static thread_local int t_worker = -1;				  // 当前线程在t_scheduler中的本地队列下标, -1表示不是工作线程
+	static thread_local volatile sig_atomic_t t_preempt = 0; // 看门狗要求当前任务在下一个安全点让出
+	static struct sigaction s_prev_sigurg;					 // 看门狗安装处理函数之前的SIGURG处理方式
+
+	// 每取多少次任务优先检查一次全局队列 -> 本地任务不断派生新任务时, 外部投递的任务也不会饿死
+	static const uint32_t kGlobalQueueInterval = 61;
+	// 每次从全局队列最多取出的任务数 -> 多取的任务放入本地队列, 减少全局锁的获取次数(其他线程仍可窃取)
+	static const size_t kGlobalBatch = 32;
+
+	// 本地队列任务节点的内存缓存 -> 投递/取出任务时不必每次都分配和释放
+	// 节点可能被窃取它的线程释放 -> 按线程而不是按队列缓存
+	struct TaskNodeCache
+	{
+		static const size_t kMaxNodes = 256;
+		std::vector<void *> nodes;
+
+		~TaskNodeCache()
+		{
+			for (void *node : nodes)
+			{
+				::operator delete(node);
+			}
+		}
+
+		void *alloc(size_t size)
+		{
+			if (nodes.empty())
+			{
+				return ::operator new(size);
+			}
+			void *node = nodes.back();
+			nodes.pop_back();
+			return node;
+		}
+
+		void free(void *node)
+		{
+			if (nodes.size() < kMaxNodes)
+			{
+				nodes.push_back(node);
+			}
+			else
+			{
+				::operator delete(node);
+			}
+		}
+	};
+
+	static thread_local TaskNodeCache t_task_nodes;
+
+	// 看门狗只需要毫秒精度 -> 使用开销更小的粗粒度时钟
+	static uint64_t NowMS()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+	}
 
 	Scheduler *Scheduler::GetThis()
 	{
@@ -18,12 +88,19 @@ namespace corlib
 	}
 
 	// 调度器构造函数
-	Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) : m_useCaller(use_caller), m_name(name)
+	Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name, size_t min_threads) : m_useCaller(use_caller), m_name(name)
 	{
 		assert(threads > 0 && Scheduler::GetThis() == nullptr); // 保证线程数大于0且当前线程没有调度器
+		assert(min_threads <= threads);
 
 		SetThis(); // 设置当前调度器为该实例
 
+		// 每个工作线程一组任务队列(使用主线程时也包括主线程)
+		for (size_t i = 0; i < threads; i++)
+		{
+			m_workers.emplace_back(new Worker());
+		}
+
 		Thread::SetName(m_name); // 设置线程名称
 
 		// 使用主线程当作工作线程
@@ -39,10 +116,17 @@ namespace corlib
 			Fiber::SetSchedulerFiber(m_schedulerFiber.get());
 
 			m_rootThread = Thread::GetThreadId(); // 获取主线程ID
-			m_threadIds.push_back(m_rootThread);  // 将主线程ID加入线程ID列表
+			m_workers[0]->thread_id = m_rootThread;
 		}
 
 		m_threadCount = threads; // 设置工作线程数
+
+		// 弹性线程池 -> 下限同样不包括主线程
+		if (min_threads > 0 && min_threads < threads + (use_caller ? 1 : 0))
+		{
+			m_elastic = true;
+			m_minThreadCount = min_threads - (use_caller ? 1 : 0);
+		}
 		if (debug)
 			std::cout << "Scheduler::Scheduler() success\n";
 	}
@@ -51,6 +135,7 @@ namespace corlib
 	Scheduler::~Scheduler()
 	{
 		assert(stopping() == true); // 确保调度器已经停止
+		stopMonitor();
 		if (GetThis() == this)
 		{
 			t_scheduler = nullptr;
@@ -59,6 +144,24 @@ namespace corlib
 			std::cout << "Scheduler::~Scheduler() success\n";
 	}
 
+	// 设置协程栈参数
+	void Scheduler::setStackOptions(size_t stacksize, StackAllocator::Mode mode)
+	{
+		m_stackSize = stacksize;
+		m_stackMode = mode;
+	}
+
+	// 设置共享栈
+	void Scheduler::setSharedStack(size_t count, size_t stacksize)
+	{
+		std::shared_ptr<SharedStackPool> pool;
+		if (count > 0)
+		{
+			pool = std::make_shared<SharedStackPool>(count, stacksize ? stacksize : 128000);
+		}
+		std::atomic_store(&m_sharedStacks, pool);
+	}
+
 	// 启动调度器
 	void Scheduler::start()
 	{
@@ -70,16 +173,44 @@ namespace corlib
 		}
 
 		assert(m_threads.empty());
+		// 弹性线程池只创建下限个线程, 其余的在排队延迟变大时再创建
 		m_threads.resize(m_threadCount);
-		for (size_t i = 0; i < m_threadCount; i++)
+		size_t count = m_elastic ? m_minThreadCount : m_threadCount;
+		for (size_t i = 0; i < count; i++)
+		{
+			startThread(i);
+		}
+		m_liveThreadCount = count;
+		if (m_elastic)
 		{
-			m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
-			m_threadIds.push_back(m_threads[i]->getId());
+			std::lock_guard<std::mutex> monitor_lock(m_monitorMutex);
+			startMonitor();
 		}
 		if (debug)
 			std::cout << "Scheduler::start() success\n";
 	}
 
+	void Scheduler::startThread(size_t index)
+	{
+		// 使用主线程时下标0留给主线程
+		int worker = m_useCaller ? index + 1 : index;
+		Placement placement;
+		if (!m_placement.empty())
+		{
+			placement = m_placement[worker];
+		}
+		m_workers[worker]->exited = false;
+		m_threads[index].reset(new Thread([this, worker, placement]()
+										  {
+			t_worker = worker;
+			if (!placement.cpus.empty() || placement.node >= 0)
+			{
+				placeWorker(worker, placement);
+			}
+			run(); }, m_name + "_" + std::to_string(index)));
+		m_workers[worker]->thread_id = m_threads[index]->getId();
+	}
+
 	// 调度器的运行函数
 	void Scheduler::run()
 	{
@@ -97,73 +228,163 @@ namespace corlib
 			Fiber::GetThis();
 		}
 
-		std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
+		auto loop = std::make_shared<ThreadLoop>();
+		loop->thread_id = thread_id;
+		if (thread_id == m_rootThread)
+		{
+			t_worker = 0;
+		}
+		assert(t_worker >= 0 && t_worker < (int)m_workers.size());
+		loop->worker = t_worker;
+		m_workers[t_worker]->thread_id = thread_id;
+		loop->idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this), m_stackSize, true, m_stackMode);
+		// 内联运行的回调被提升后, 由新的调度协程接着运行调度循环
+		std::weak_ptr<ThreadLoop> weak_loop(loop);
+		loop->promote = [this, weak_loop]()
+		{
+			// 被提升的回调不再占用本线程
+			m_activeThreadCount--;
+			m_pendingTaskCount--;
+			m_workers[t_worker]->task_start.store(0, std::memory_order_relaxed);
+			t_preempt = 0;
+			return std::make_shared<Fiber>(std::bind(&Scheduler::runLoop, this, weak_loop.lock()), m_stackSize, false, m_stackMode);
+		};
+
+		if (thread_id == m_rootThread)
+		{
+			// 已经运行在调度协程m_schedulerFiber上
+			runLoop(loop);
+		}
+		else
+		{
+			// 调度循环运行在独立的协程上而不是线程栈上 -> 被提升后可以迁移到其他线程继续运行回调
+			std::shared_ptr<Fiber> loop_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::runLoop, this, loop), m_stackSize, false, m_stackMode);
+			Fiber::SetSchedulerFiber(loop_fiber.get());
+			// 返回时调度循环已经结束(可能由接替它的调度协程结束)
+			loop_fiber->resume();
+		}
+
+		if (debug)
+			std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
+	}
+
+	void Scheduler::runLoop(std::shared_ptr<ThreadLoop> loop)
+	{
 		ScheduleTask task;
+		Worker &worker = *m_workers[loop->worker];
 
 		while (true)
 		{
+			// 上一个任务已经结束或挂起 -> 不再被看门狗计时
+			if (worker.task_start.load(std::memory_order_relaxed))
+			{
+				worker.task_start.store(0, std::memory_order_relaxed);
+				t_preempt = 0;
+			}
 			task.reset();
-			bool tickle_me = false;
-
+			bool found = nextTask(*loop, task);
+			if (found && task.enqueued)
+			{
+				recordDelay(task);
+			}
+			// 被唤醒的线程取过任务之后不再算作寻找任务 -> 还有排队的任务则接力唤醒下一个线程
+			if (worker.searching)
 			{
-				std::lock_guard<std::mutex> lock(m_mutex);
-				auto it = m_tasks.begin();
-				// 遍历任务队列
-				while (it != m_tasks.end())
+				worker.searching = false;
+				m_searchingCount--;
+				if (found && (m_highTaskCount > 0 || m_globalTaskCount > 0 || m_localTaskCount > 0))
 				{
-					if (it->thread != -1 && it->thread != thread_id)
-					{
-						it++;
-						tickle_me = true;
-						continue;
-					}
-
-					// 取出任务
-					assert(it->fiber || it->cb);
-					task = *it;
-					m_tasks.erase(it);
-					m_activeThreadCount++;
-					break;
+					tickle();
 				}
-				tickle_me = tickle_me || (it != m_tasks.end());
 			}
-
-			if (tickle_me)
+			if (found)
 			{
-				tickle();
+				// 只有本线程写 -> 不需要原子的加法
+				worker.task_seq.store(worker.task_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				// 看门狗开启 -> 记录任务的开始时刻
+				if (m_watchdogSlice.load(std::memory_order_relaxed))
+				{
+					worker.task_start.store(NowMS(), std::memory_order_release);
+				}
 			}
 
 			// 执行任务
 			if (task.fiber)
 			{
+				// 协程可能在其他线程上还没切出 -> 由状态机决定是否在这里恢复
+				bool stack_busy = false;
+				task.fiber->tryResume(&stack_busy);
+				if (stack_busy)
 				{
-					std::lock_guard<std::mutex> lock(task.fiber->m_mutex);
-					if (task.fiber->getState() != Fiber::TERM)
-					{
-						task.fiber->resume();
-					}
+					requeueStackBusy(task.fiber, task.thread, (Priority)task.priority);
 				}
 				m_activeThreadCount--;
+				m_pendingTaskCount--;
 				task.reset();
 			}
 			else if (task.cb)
 			{
-				std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);
+				auto pool = std::atomic_load(&m_sharedStacks);
+				if (m_inlineCallbacks && !pool)
+				{
+					// 直接在调度协程上运行, 挂起前才提升为独立的协程
+					if (!Fiber::RunInline(task.cb, loop->promote))
+					{
+						// 已被提升, 回调在提升后的协程上结束 -> 调度循环已由接替的调度协程继续
+						return;
+					}
+					m_activeThreadCount--;
+					m_pendingTaskCount--;
+					task.reset();
+					continue;
+				}
+
+				std::shared_ptr<Fiber> &cb_fiber = loop->cb_fiber;
+				// 复用上一个已结束的回调协程 -> 省去栈的分配和释放
+				if (cb_fiber)
+				{
+					cb_fiber->reset(task.cb);
+				}
+				else if (pool)
+				{
+					cb_fiber = std::make_shared<Fiber>(task.cb, pool->next());
+				}
+				else
+				{
+					cb_fiber = std::make_shared<Fiber>(task.cb, m_stackSize, true, m_stackMode);
+				}
+				if (pool)
+				{
+					bool stack_busy = false;
+					cb_fiber->tryResume(&stack_busy);
+					if (stack_busy)
+					{
+						FiberRef fiber(cb_fiber);
+						cb_fiber.reset();
+						requeueStackBusy(fiber, task.thread, (Priority)task.priority);
+					}
+				}
+				else
 				{
-					std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
 					cb_fiber->resume();
 				}
 				m_activeThreadCount--;
+				m_pendingTaskCount--;
 				task.reset();
+
+				// 协程被挂起(或仍被其他地方引用) -> 交给持有者, 下次重新创建
+				if (cb_fiber && (cb_fiber->getState() != Fiber::TERM || cb_fiber.use_count() != 1))
+				{
+					cb_fiber.reset();
+				}
 			}
 			// 无任务 -> 执行空闲协程
 			else
 			{
+				std::shared_ptr<Fiber> &idle_fiber = loop->idle_fiber;
 				// 系统关闭 -> idle协程将从死循环跳出并结束 -> 此时的idle协程状态为TERM -> 再次进入将跳出循环并退出run()
 				if (idle_fiber->getState() == Fiber::TERM)
 				{
-					if (debug)
-						std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
 					break;
 				}
 				m_idleThreadCount++;
@@ -171,83 +392,1078 @@ namespace corlib
 				m_idleThreadCount--;
 			}
 		}
+		// 调度循环真正结束(run()可能已经由被提升的回调提前返回)
+		t_worker = -1;
+		worker.exited = true;
 	}
 
-	// 停止调度器
-	void Scheduler::stop()
+	bool Scheduler::pushLocal(ScheduleTask &task, bool wake)
 	{
-		if (debug)
-			std::cout << "Schedule::stop() starts in thread: " << Thread::GetThreadId() << std::endl;
+		if (t_worker < 0 || t_scheduler != this)
+		{
+			return false;
+		}
+		// 先计数再入队 -> stopping()不会在任务还在队列中时返回true
+		m_pendingTaskCount++;
+		m_localTaskCount++;
+		m_workers[t_worker]->local.push(new (t_task_nodes.alloc(sizeof(ScheduleTask))) ScheduleTask(std::move(task)));
+		// 唤醒空闲线程来窃取(没有空闲线程时tickle直接返回)
+		if (wake)
+		{
+			tickle();
+		}
+		return true;
+	}
 
-		if (stopping())
+	bool Scheduler::nextTask(ThreadLoop &loop, ScheduleTask &task)
+	{
+		// 信箱中的任务只能在本线程运行 -> 优先取出
+		if (popMailbox(loop.worker, task))
 		{
-			return;
+			return true;
 		}
 
-		m_stopping = true;
+		// 高优先级任务连续运行够burst个 -> 先给普通任务一次机会
+		bool high_first = loop.high_streak < m_priorityBurst.load(std::memory_order_relaxed);
+		if (high_first && popHigh(task))
+		{
+			loop.high_streak++;
+			return true;
+		}
+		loop.high_streak = 0;
+		if (nextNormalTask(loop, task))
+		{
+			return true;
+		}
+		if (!high_first && popHigh(task))
+		{
+			loop.high_streak = 1;
+			return true;
+		}
+		return false;
+	}
 
-		if (m_useCaller)
+	bool Scheduler::nextNormalTask(ThreadLoop &loop, ScheduleTask &task)
+	{
+		auto take = [&](ScheduleTask *t)
 		{
-			assert(GetThis() == this);
+			if (!t)
+			{
+				return false;
+			}
+			// 先计为活跃再减少排队数 -> stopping()看不到两者同时为0的间隙
+			m_activeThreadCount++;
+			m_localTaskCount--;
+			task = std::move(*t);
+			t->~ScheduleTask();
+			t_task_nodes.free(t);
+			return true;
+		};
+
+		WorkStealingQueue<ScheduleTask> &local = m_workers[loop.worker]->local;
+		uint32_t tick = ++loop.tick;
+		bool global_first = tick % kGlobalQueueInterval == 0;
+		// 本地队列后进先出, 不断重新投递自己的任务会一直压住下面的任务 -> 定期取出本地最早的任务
+		if (tick % kGlobalQueueInterval == kGlobalQueueInterval / 2 && take(local.steal()))
+		{
+			return true;
 		}
-		else
+		if (!global_first && take(local.pop()))
 		{
-			assert(GetThis() != this);
+			return true;
+		}
+		if (popGlobal(loop.worker, task))
+		{
+			return true;
+		}
+		if (global_first && take(local.pop()))
+		{
+			return true;
 		}
 
-		for (size_t i = 0; i < m_threadCount; i++)
+		// 从其他线程的本地队列窃取最早的任务, 每次从不同的线程开始
+		size_t count = m_workers.size();
+		size_t start = loop.worker + loop.tick;
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t victim = (start + i) % count;
+			if (victim != loop.worker && take(m_workers[victim]->local.steal()))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Scheduler::popGlobal(size_t worker, ScheduleTask &task)
+	{
+		size_t pending = m_globalTaskCount.load(std::memory_order_relaxed);
+		if (pending == 0)
+		{
+			return false;
+		}
+		// 按工作线程数均分积压的任务, 避免一个线程拿走全部
+		size_t batch = std::min(pending / m_workers.size() + 1, kGlobalBatch);
+
+		bool more;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_tasks.pop(task))
+			{
+				return false;
+			}
+			assert(task.fiber || task.cb);
+			m_globalTaskCount--;
+			m_activeThreadCount++;
+
+			WorkStealingQueue<ScheduleTask> &local = m_workers[worker]->local;
+			ScheduleTask extra;
+			size_t moved = 0;
+			for (; moved + 1 < batch && m_tasks.pop(extra); moved++)
+			{
+				// 先计入本地队列再从全局计数中减去 -> stopping()不会看到两者同时为0
+				m_localTaskCount++;
+				m_globalTaskCount--;
+				local.push(new (t_task_nodes.alloc(sizeof(ScheduleTask))) ScheduleTask(std::move(extra)));
+			}
+			more = !m_tasks.empty() || moved > 0;
+		}
+
+		// 还有任务 -> 唤醒其他空闲线程
+		if (more)
 		{
 			tickle();
 		}
+		return true;
+	}
 
-		if (m_schedulerFiber)
+	void Scheduler::pushHigh(ScheduleTask &task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pendingTaskCount++;
+			m_highTaskCount++;
+			m_highTasks.push(std::move(task));
+		}
+		tickle();
+	}
+
+	void Scheduler::pushGlobal(ScheduleTask &task)
+	{
+		bool need_tickle;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			// empty ->  all thread is idle -> need to be waken up
+			need_tickle = m_tasks.empty();
+			m_tasks.push(std::move(task));
+			m_globalTaskCount++;
+			m_pendingTaskCount++;
+		}
+
+		if (need_tickle)
 		{
 			tickle();
 		}
+	}
 
-		if (m_schedulerFiber)
+	void Scheduler::requeueStackBusy(FiberRef &fiber, int thread, Priority priority)
+	{
+		ScheduleTask task(&fiber, thread);
+		markEnqueued(task, priority);
+		if (thread != -1 && pushPinned(task))
 		{
-			m_schedulerFiber->resume();
-			if (debug)
-				std::cout << "m_schedulerFiber ends in thread:" << Thread::GetThreadId() << std::endl;
+			return;
+		}
+		if (priority == PRIORITY_HIGH)
+		{
+			pushHigh(task);
+			return;
 		}
+		pushGlobal(task);
+	}
 
-		std::vector<std::shared_ptr<Thread>> thrs;
+	bool Scheduler::popHigh(ScheduleTask &task)
+	{
+		if (m_highTaskCount.load(std::memory_order_relaxed) == 0)
+		{
+			return false;
+		}
+
+		bool more;
 		{
 			std::lock_guard<std::mutex> lock(m_mutex);
-			thrs.swap(m_threads);
+			if (!m_highTasks.pop(task))
+			{
+				return false;
+			}
+			m_highTaskCount--;
+			m_activeThreadCount++;
+			more = !m_highTasks.empty();
 		}
 
-		for (auto &i : thrs)
+		if (more)
 		{
-			i->join();
+			tickle();
 		}
-		if (debug)
-			std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
+		return true;
 	}
 
-	// 唤醒调度器
-	void Scheduler::tickle()
+	void Scheduler::recordDelay(const ScheduleTask &task)
 	{
+		uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		uint64_t delay = now > task.enqueued ? now - task.enqueued : 0;
+		if (m_queueDelayMetrics.load(std::memory_order_relaxed))
+		{
+			m_queueDelay[task.priority].record(delay);
+		}
+		// 排队太久 -> 由监控线程扩容(已经标记过就不再写, 避免所有线程争用同一个缓存行)
+		if (m_elastic && delay >= m_growDelayMs.load(std::memory_order_relaxed) * 1000000 &&
+			!m_delayExceeded.load(std::memory_order_relaxed))
+		{
+			m_delayExceeded.store(true, std::memory_order_relaxed);
+		}
 	}
 
-	// 空闲处理函数
-	void Scheduler::idle()
+	void Scheduler::DelayHistogram::record(uint64_t ns)
 	{
-		while (!stopping())
+		// 桶下标 = 最高位所在的2的幂 * 8 + 最高位之后的3位
+		int index = ns;
+		if (ns >= kSubBuckets)
+		{
+			int log = 63 - __builtin_clzll(ns);
+			index = (log - 2) * kSubBuckets + ((ns >> (log - 3)) & (kSubBuckets - 1));
+		}
+		buckets[std::min(index, kBuckets - 1)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t old = max.load(std::memory_order_relaxed);
+		while (ns > old && !max.compare_exchange_weak(old, ns, std::memory_order_relaxed))
 		{
-			if (debug)
-				std::cout << "Scheduler::idle(), sleeping in thread: " << Thread::GetThreadId() << std::endl;
-			sleep(1);
-			Fiber::GetThis()->yield();
 		}
 	}
 
-	// 判断调度器是否可以停止
-	bool Scheduler::stopping()
+	// 桶的上界(不含)
+	static uint64_t BucketLimit(int index)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+		static const int kSubBuckets = 8;
+		if (index < kSubBuckets)
+		{
+			return index + 1;
+		}
+		int log = index / kSubBuckets + 2;
+		uint64_t sub = index % kSubBuckets;
+		return (1ull << log) + ((sub + 1) << (log - 3));
+	}
+
+	Scheduler::QueueDelayStats Scheduler::DelayHistogram::stats() const
+	{
+		QueueDelayStats stats;
+		stats.count = count.load(std::memory_order_relaxed);
+		if (stats.count == 0)
+		{
+			return stats;
+		}
+		stats.mean_ns = sum.load(std::memory_order_relaxed) / stats.count;
+		stats.max_ns = max.load(std::memory_order_relaxed);
+
+		uint64_t p50 = (stats.count + 1) / 2;
+		uint64_t p99 = stats.count - stats.count / 100;
+		uint64_t seen = 0;
+		for (int i = 0; i < kBuckets; i++)
+		{
+			seen += buckets[i].load(std::memory_order_relaxed);
+			if (!stats.p50_ns && seen >= p50)
+			{
+				stats.p50_ns = std::min(BucketLimit(i), stats.max_ns);
+			}
+			if (seen >= p99)
+			{
+				stats.p99_ns = std::min(BucketLimit(i), stats.max_ns);
+				break;
+			}
+		}
+		return stats;
+	}
+
+	void Scheduler::DelayHistogram::reset()
+	{
+		for (int i = 0; i < kBuckets; i++)
+		{
+			buckets[i].store(0, std::memory_order_relaxed);
+		}
+		count.store(0, std::memory_order_relaxed);
+		sum.store(0, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+	}
+
+	Scheduler::QueueDelayStats Scheduler::getQueueDelay(Priority priority) const
+	{
+		return m_queueDelay[priority].stats();
+	}
+
+	void Scheduler::resetQueueDelay()
+	{
+		for (int i = 0; i < PRIORITY_COUNT; i++)
+		{
+			m_queueDelay[i].reset();
+		}
+	}
+
+	bool Scheduler::pushPinned(ScheduleTask &task)
+	{
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			Worker &worker = *m_workers[i];
+			if (worker.thread_id.load(std::memory_order_relaxed) != task.thread)
+			{
+				continue;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(worker.mailbox_mutex);
+				// 弹性线程池中的线程可能刚刚退出 -> 在信箱的锁内确认
+				if (worker.thread_id.load(std::memory_order_relaxed) != task.thread)
+				{
+					break;
+				}
+				m_pendingTaskCount++;
+				m_pinnedTaskCount++;
+				worker.mailbox_count++;
+				worker.mailbox.push(std::move(task));
+			}
+			// 只唤醒目标线程, 目标线程就是当前线程时它会在下一轮调度中取出
+			if (getWorkerIndex() != (int)i)
+			{
+				tickleWorker(i);
+			}
+			return true;
+		}
+
+		// 不是本调度器的线程(或者是弹性线程池中已经退出的线程) -> 按不指定线程处理
+		assert(m_elastic || !"thread is not a worker of this scheduler");
+		task.thread = -1;
+		return false;
+	}
+
+	bool Scheduler::popMailbox(size_t index, ScheduleTask &task)
+	{
+		Worker &worker = *m_workers[index];
+		if (worker.mailbox_count.load(std::memory_order_relaxed) == 0)
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(worker.mailbox_mutex);
+		if (!worker.mailbox.pop(task))
+		{
+			return false;
+		}
+		worker.mailbox_count--;
+		m_activeThreadCount++;
+		m_pinnedTaskCount--;
+		return true;
+	}
+
+	void Scheduler::setCpuAffinity(const std::vector<int> &cpus)
+	{
+		std::vector<Placement> placement(m_workers.size());
+		for (size_t i = 0; i < placement.size() && !cpus.empty(); i++)
+		{
+			int cpu = cpus[i % cpus.size()];
+			placement[i].cpus.push_back(cpu);
+			placement[i].node = Numa::CpuNode(cpu);
+		}
+		applyPlacement(placement);
+	}
+
+	void Scheduler::setNumaSpread()
+	{
+		const std::vector<int> &nodes = Numa::Nodes();
+		std::vector<Placement> placement(m_workers.size());
+		for (size_t i = 0; i < placement.size(); i++)
+		{
+			int node = nodes[i % nodes.size()];
+			placement[i].cpus = Numa::NodeCpus(node);
+			placement[i].node = node;
+		}
+		applyPlacement(placement);
+	}
+
+	void Scheduler::applyPlacement(const std::vector<Placement> &placement)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_placement = placement;
+		}
+
+		int self = Thread::GetThreadId();
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			// 还没启动的线程在start()中放置
+			int thread_id = m_workers[i]->thread_id;
+			if (thread_id == -1)
+			{
+				continue;
+			}
+			// 亲和性和内存策略只能由线程自己设置 -> 其他线程通过信箱在它上面运行
+			if (thread_id == self)
+			{
+				placeWorker(i, placement[i]);
+			}
+			else
+			{
+				// 线程在投递之前退出时任务会在其他线程上运行 -> 不放置
+				scheduleLock([this, i, p = placement[i]]()
+							 {
+								 if (getWorkerIndex() == (int)i)
+								 {
+									 placeWorker(i, p);
+								 } },
+							 thread_id);
+			}
+		}
+	}
+
+	void Scheduler::placeWorker(size_t index, const Placement &placement)
+	{
+		Numa::SetThreadAffinity(0, placement.cpus);
+		Numa::SetPreferredNode(placement.node);
+		// 之后释放和申请的协程栈都留在本节点
+		StackAllocator::SetThreadNode(placement.node);
+		if (placement.node < 0)
+		{
+			return;
+		}
+
+		// 队列在构造时由创建调度器的线程分配 -> 迁移到本节点
+		Worker &worker = *m_workers[index];
+		Numa::MoveToNode(&worker, sizeof(Worker), placement.node);
+		worker.local.relocate();
+		std::lock_guard<std::mutex> lock(worker.mailbox_mutex);
+		worker.mailbox.relocate();
+	}
+
+	int Scheduler::getWorkerIndex() const
+	{
+		return t_scheduler == this ? t_worker : -1;
+	}
+
+	void Scheduler::tickleWorker(size_t worker)
+	{
+		// 没有停车说明它正在运行或自旋, 会在下一轮调度中看到信箱中的任务
+		unparkWorker(worker);
+	}
+
+	bool Scheduler::hasPendingTasks(size_t worker) const
+	{
+		return m_workers[worker]->mailbox_count > 0 || m_highTaskCount > 0 || m_globalTaskCount > 0 || m_localTaskCount > 0;
+	}
+
+	bool Scheduler::parkWorker(uint64_t timeout_ms)
+	{
+		int index = getWorkerIndex();
+		assert(index >= 0);
+		Worker &worker = *m_workers[index];
+		// 弹性线程池 -> 至少每半个空闲退出时间醒来一次, 由retireWorker决定是否退出
+		if (m_elastic)
+		{
+			timeout_ms = std::min(timeout_ms, std::max<uint64_t>(m_retireIdleMs / 2, 1));
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_parkMutex);
+			worker.parked = true;
+			m_parked.push_back(index);
+		}
+
+		// 登记之后再检查一次 -> 投递任务后的唤醒要么看到本线程已经停车, 要么任务在这里被看到
+		bool woken = false;
+		if (!hasPendingTasks(index) && !stopping())
+		{
+			std::unique_lock<std::mutex> lock(worker.park_mutex);
+			woken = worker.park_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&]()
+											  { return worker.notified; });
+			worker.notified = false;
+		}
+
+		// 超时或者没有睡眠 -> 自己从停车列表中移除
+		std::lock_guard<std::mutex> lock(m_parkMutex);
+		if (worker.parked)
+		{
+			worker.parked = false;
+			m_parked.erase(std::find(m_parked.begin(), m_parked.end(), (size_t)index));
+		}
+		else
+		{
+			// 已被unparkWorker从列表中取走 -> 认领它增加的计数(即使没有真正睡眠)
+			worker.searching = true;
+		}
+		return woken;
+	}
+
+	bool Scheduler::unparkWorker()
+	{
+		size_t index;
+		{
+			std::lock_guard<std::mutex> lock(m_parkMutex);
+			if (m_parked.empty())
+			{
+				return false;
+			}
+			index = m_parked.back();
+			m_parked.pop_back();
+			m_workers[index]->parked = false;
+			beginWakeup();
+		}
+		notifyWorker(index);
+		return true;
+	}
+
+	bool Scheduler::unparkWorker(size_t index)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_parkMutex);
+			Worker &worker = *m_workers[index];
+			if (!worker.parked)
+			{
+				return false;
+			}
+			worker.parked = false;
+			m_parked.erase(std::find(m_parked.begin(), m_parked.end(), index));
+			beginWakeup();
+		}
+		notifyWorker(index);
+		return true;
+	}
+
+	void Scheduler::beginWakeup()
+	{
+		m_searchingCount++;
+		m_wakeupCount++;
+	}
+
+	void Scheduler::claimWakeup()
+	{
+		int index = getWorkerIndex();
+		assert(index >= 0 && !m_workers[index]->searching);
+		m_workers[index]->searching = true;
+	}
+
+	void Scheduler::notifyWorker(size_t index)
+	{
+		Worker &worker = *m_workers[index];
+		std::lock_guard<std::mutex> lock(worker.park_mutex);
+		worker.notified = true;
+		worker.park_cond.notify_one();
+	}
+
+	// 停止调度器
+	void Scheduler::stop()
+	{
+		if (debug)
+			std::cout << "Schedule::stop() starts in thread: " << Thread::GetThreadId() << std::endl;
+
+		if (stopping())
+		{
+			return;
+		}
+
+		m_stopping = true;
+
+		if (m_useCaller)
+		{
+			assert(GetThis() == this);
+		}
+		else
+		{
+			assert(GetThis() != this);
+		}
+
+		for (size_t i = 0; i < m_threadCount; i++)
+		{
+			tickle();
+		}
+
+		if (m_schedulerFiber)
+		{
+			tickle();
+		}
+
+		if (m_schedulerFiber)
+		{
+			m_schedulerFiber->resume();
+			if (debug)
+				std::cout << "m_schedulerFiber ends in thread:" << Thread::GetThreadId() << std::endl;
+		}
+
+		std::vector<std::shared_ptr<Thread>> thrs;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			thrs.swap(m_threads);
+		}
+
+		// 弹性线程池中没有创建(或已经回收)的线程为空
+		for (auto &i : thrs)
+		{
+			if (i)
+			{
+				i->join();
+			}
+		}
+		stopMonitor();
+		if (debug)
+			std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
+	}
+
+	// 唤醒调度器 -> 唤醒一个停车的工作线程
+	void Scheduler::tickle()
+	{
+		// 没有空闲线程, 或者有线程正在寻找任务(它会自己取到任务, 取到后如果还有任务再接力唤醒)
+		if (!hasIdleThreads() || hasSearchingThreads())
+		{
+			return;
+		}
+		unparkWorker();
+	}
+
+	// 空闲处理函数: 先自旋等待一小段时间, 仍然没有任务再停车
+	void Scheduler::idle()
+	{
+		static const uint64_t MAX_TIMEOUT = 5000;
+		int worker = getWorkerIndex();
+		while (!stopping())
+		{
+			if (debug)
+				std::cout << "Scheduler::idle(), parking in thread: " << Thread::GetThreadId() << std::endl;
+			if (!spinForTasks(worker) && !parkWorker(MAX_TIMEOUT) && retireWorker())
+			{
+				// 弹性线程池中空闲太久的线程退出 -> 不参与关闭时的接力唤醒
+				return;
+			}
+			Fiber::GetThis()->yield();
+		}
+		// 依次唤醒其他空闲线程退出
+		unparkWorker();
+	}
+
+	// 自旋等待时让出流水线资源
+	static inline void CpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	bool Scheduler::spinForTasks(size_t worker)
+	{
+		// 最多一半的工作线程同时自旋 -> 其余的直接停车, 不白白占用CPU
+		if ((m_searchingCount + 1) * 2 > m_workers.size() + 1)
+		{
+			return false;
+		}
+		static const int kSpinRounds = 256;
+		m_searchingCount++;
+		bool found = false;
+		for (int i = 0; i < kSpinRounds && !found && !m_stopping; i++)
+		{
+			CpuRelax();
+			found = hasPendingTasks(worker);
+		}
+		if (found)
+		{
+			// 自旋期间的tickle被合并了 -> 取到任务之后由调度循环决定是否接力唤醒
+			m_workers[worker]->searching = true;
+		}
+		else
+		{
+			// 停止自旋之后投递的任务由停车前的检查或tickle看到
+			m_searchingCount--;
+		}
+		return found;
+	}
+
+	// 判断调度器是否可以停止
+	bool Scheduler::stopping()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// 先看等待数: 协程恢复运行之后才减少等待数 -> 等待数为0时它一定已经计入m_pendingTaskCount
+		return m_stopping && m_externalWaitCount == 0 && m_pendingTaskCount == 0;
+	}
+
+	void Scheduler::Yield()
+	{
+		Scheduler *scheduler = t_scheduler;
+		if (!scheduler || t_worker < 0 || !Fiber::InTask())
+		{
+			return;
+		}
+		// 排到全局队列末尾 -> 先运行已经在排队的任务; GetThisRef会提升内联运行的回调
+		ScheduleTask task(Fiber::GetThisRef(), -1);
+		scheduler->markEnqueued(task, PRIORITY_NORMAL);
+		scheduler->pushGlobal(task);
+		Fiber::yieldToReady();
+	}
+
+	void Scheduler::PreemptPoint()
+	{
+		if (!t_preempt)
+		{
+			return;
+		}
+		t_preempt = 0;
+		Yield();
+	}
+
+	void Scheduler::setWatchdog(uint64_t slice_ms, bool preempt)
+	{
+		if (slice_ms)
+		{
+			static std::once_flag once;
+			std::call_once(once, []()
+						   {
+				// backtrace第一次调用时会加载libgcc -> 在信号处理函数之外先调用一次
+				void *frame;
+				backtrace(&frame, 1);
+
+				struct sigaction sa;
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_sigaction = &Scheduler::WatchdogSignalHandler;
+				sa.sa_flags = SA_RESTART | SA_SIGINFO;
+				sigemptyset(&sa.sa_mask);
+				sigaction(SIGURG, &sa, &s_prev_sigurg); });
+		}
+
+		std::lock_guard<std::mutex> lock(m_monitorMutex);
+		m_watchdogPreempt = preempt;
+		m_watchdogSlice = slice_ms;
+		if (slice_ms)
+		{
+			startMonitor();
+		}
+		m_monitorCond.notify_one();
+	}
+
+	void Scheduler::setOverrunHandler(std::function<void(const OverrunReport &)> handler)
+	{
+		std::lock_guard<std::mutex> lock(m_monitorMutex);
+		m_overrunHandler = std::move(handler);
+	}
+
+	void Scheduler::setElasticOptions(uint64_t grow_delay_ms, uint64_t retire_idle_ms)
+	{
+		std::lock_guard<std::mutex> lock(m_monitorMutex);
+		m_growDelayMs = grow_delay_ms ? grow_delay_ms : 1;
+		m_retireIdleMs = retire_idle_ms ? retire_idle_ms : 1;
+		m_monitorCond.notify_one();
+	}
+
+	Scheduler::WorkerPoolStats Scheduler::getWorkerPoolStats() const
+	{
+		size_t caller = m_useCaller ? 1 : 0;
+		WorkerPoolStats stats;
+		stats.threads = m_liveThreadCount + caller;
+		stats.min_threads = (m_elastic ? m_minThreadCount : m_threadCount) + caller;
+		stats.max_threads = m_threadCount + caller;
+		stats.grown = m_growCount;
+		stats.retired = m_retireCount;
+		return stats;
+	}
+
+	bool Scheduler::spawnWorker()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// 还没有启动, 或者已经开始关闭(m_threads已被stop()取走)
+		if (m_stopping || m_threads.empty() || m_liveThreadCount >= m_threadCount)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < m_threads.size(); i++)
+		{
+			Worker &worker = *m_workers[m_useCaller ? i + 1 : i];
+			if (m_threads[i] && !worker.exited)
+			{
+				continue;
+			}
+			// 回收已经退出的线程 -> 调度循环已经结束, 不会再获取m_mutex
+			if (m_threads[i])
+			{
+				m_threads[i]->join();
+			}
+			startThread(i);
+			m_liveThreadCount++;
+			m_growCount++;
+			return true;
+		}
+		// 退出的线程还没有结束调度循环 -> 下次检查时再创建
+		return false;
+	}
+
+	bool Scheduler::retireWorker()
+	{
+		int index = getWorkerIndex();
+		if (!m_elastic || index < 0 || (m_useCaller && index == 0))
+		{
+			return false;
+		}
+		Worker &worker = *m_workers[index];
+		uint64_t now = NowMS();
+		uint64_t seq = worker.task_seq.load(std::memory_order_relaxed);
+		// 上次检查之后运行过任务 -> 重新开始计算空闲时间
+		if (seq != worker.idle_seq || !worker.idle_since)
+		{
+			worker.idle_seq = seq;
+			worker.idle_since = now;
+			return false;
+		}
+		// 被唤醒的线程持有寻找任务的计数, 不能直接退出
+		if (worker.searching || now - worker.idle_since < m_retireIdleMs || hasPendingTasks(index))
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_stopping || m_liveThreadCount <= m_minThreadCount)
+		{
+			return false;
+		}
+		// 不再接收指定本线程的任务 -> 信箱为空才可以退出
+		std::lock_guard<std::mutex> mailbox_lock(worker.mailbox_mutex);
+		if (!worker.mailbox.empty())
+		{
+			return false;
+		}
+		worker.thread_id = -1;
+		worker.idle_since = 0;
+		m_liveThreadCount--;
+		m_retireCount++;
+		return true;
+	}
+
+	void Scheduler::checkGrowth()
+	{
+		// 可以被其他线程取走的排队任务(信箱中的任务只能由指定的线程运行, 扩容没有帮助)
+		size_t queued = m_globalTaskCount + m_highTaskCount + m_localTaskCount;
+		uint64_t now = NowMS();
+		uint64_t progress = 0;
+		for (auto &worker : m_workers)
+		{
+			progress += worker->task_seq.load(std::memory_order_relaxed);
+		}
+		if (progress != m_lastProgress || !queued)
+		{
+			m_lastProgress = progress;
+			m_progressSince = now;
+		}
+		// 所有线程都被长时间运行(或阻塞)的任务占住, 排队的任务一直没有被取走
+		bool stalled = queued && now - m_progressSince >= m_growDelayMs;
+		// 取出的任务排队超过了阈值
+		bool delayed = m_delayExceeded.exchange(false, std::memory_order_relaxed);
+		// 有空闲线程时由它们运行排队的任务
+		if ((stalled || delayed) && queued && m_idleThreadCount == 0 && spawnWorker())
+		{
+			m_progressSince = now;
+		}
+	}
+
+	void Scheduler::startMonitor()
+	{
+		if (!m_monitorThread && !m_monitorStop)
+		{
+			// 监控线程不开启hook
+			m_monitorThread.reset(new Thread(std::bind(&Scheduler::monitorLoop, this), m_name + "_monitor"));
+		}
+	}
+
+	void Scheduler::monitorLoop()
+	{
+		std::unique_lock<std::mutex> lock(m_monitorMutex);
+		while (!m_monitorStop)
+		{
+			uint64_t slice = m_watchdogSlice;
+			if (!slice && !m_elastic)
+			{
+				m_monitorCond.wait(lock);
+				continue;
+			}
+			// 每半个时间片检查一次 -> 任务最多运行1.5个时间片才被发现; 扩容同理
+			uint64_t interval = slice ? std::max<uint64_t>(slice / 2, 1) : UINT64_MAX;
+			if (m_elastic)
+			{
+				interval = std::min(interval, std::max<uint64_t>(m_growDelayMs / 2, 1));
+			}
+			m_monitorCond.wait_for(lock, std::chrono::milliseconds(interval));
+			if (m_monitorStop)
+			{
+				break;
+			}
+			slice = m_watchdogSlice;
+			lock.unlock();
+			if (slice)
+			{
+				checkOverruns(slice);
+			}
+			if (m_elastic)
+			{
+				checkGrowth();
+			}
+			lock.lock();
+		}
+	}
+
+	// 默认的报告方式: 输出到标准错误
+	static void PrintOverrun(const std::string &name, const Scheduler::OverrunReport &report)
+	{
+		std::ostringstream os;
+		os << "[" << name << "] watchdog: worker " << report.worker << " (thread " << report.thread_id
+		   << ") fiber " << report.fiber_id << " has been running for " << report.running_ms << " ms"
+		   << (report.preempt ? ", preemption requested" : "") << "\n";
+		char **symbols = backtrace_symbols(report.frames.data(), report.frames.size());
+		for (size_t i = 0; i < report.frames.size(); i++)
+		{
+			os << "    #" << i << " ";
+			if (symbols)
+			{
+				os << symbols[i];
+			}
+			else
+			{
+				os << report.frames[i];
+			}
+			os << "\n";
+		}
+		free(symbols);
+		std::cerr << os.str() << std::flush;
+	}
+
+	void Scheduler::checkOverruns(uint64_t slice_ms)
+	{
+		std::function<void(const OverrunReport &)> handler;
+		{
+			std::lock_guard<std::mutex> lock(m_monitorMutex);
+			handler = m_overrunHandler;
+		}
+		bool preempt = m_watchdogPreempt;
+
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			Worker &worker = *m_workers[i];
+			uint64_t start = worker.task_start.load(std::memory_order_acquire);
+			uint64_t seq = worker.task_seq.load(std::memory_order_relaxed);
+			uint64_t now = NowMS();
+			// 没有在运行任务, 还没有超时, 或者这个任务已经报告过
+			if (!start || now < start + slice_ms || seq == worker.watched_seq)
+			{
+				continue;
+			}
+			worker.watched_seq = seq;
+
+			OverrunReport report;
+			report.worker = i;
+			report.thread_id = worker.thread_id;
+			report.running_ms = now - start;
+			report.preempt = preempt;
+
+			// 请求所在线程在信号处理函数中采集调用栈(并设置让出标记), 最多等待10ms
+			worker.sample_seq = seq;
+			worker.sample_preempt = preempt;
+			worker.sample_state.store(1, std::memory_order_release);
+			if (syscall(SYS_tgkill, getpid(), report.thread_id, SIGURG) == 0)
+			{
+				for (int n = 0; n < 100 && worker.sample_state.load(std::memory_order_acquire) != 3; n++)
+				{
+					usleep(100);
+				}
+			}
+			// 没有响应 -> 撤回请求; 已经开始采集 -> 等它完成(信号处理函数不会阻塞)
+			int state = 1;
+			if (!worker.sample_state.compare_exchange_strong(state, 0))
+			{
+				while (worker.sample_state.load(std::memory_order_acquire) != 3)
+				{
+					sched_yield();
+				}
+				report.fiber_id = worker.sample_fiber;
+				// 跳过信号处理函数自身
+				if (worker.sample_depth > 1)
+				{
+					report.frames.assign(worker.sample_frames + 1, worker.sample_frames + worker.sample_depth);
+				}
+				worker.sample_state.store(0, std::memory_order_relaxed);
+			}
+
+			m_overrunCount++;
+			if (handler)
+			{
+				handler(report);
+			}
+			else
+			{
+				PrintOverrun(m_name, report);
+			}
+		}
+	}
+
+	void Scheduler::stopMonitor()
+	{
+		std::shared_ptr<Thread> thread;
+		{
+			std::lock_guard<std::mutex> lock(m_monitorMutex);
+			m_monitorStop = true;
+			thread.swap(m_monitorThread);
+		}
+		m_monitorCond.notify_one();
+		if (thread)
+		{
+			thread->join();
+		}
+	}
+
+	// 把不是看门狗发出的SIGURG交给之前的处理函数(默认和忽略都是丢弃)
+	static void ChainSigurg(int signo, siginfo_t *info, void *context)
+	{
+		if (s_prev_sigurg.sa_flags & SA_SIGINFO)
+		{
+			s_prev_sigurg.sa_sigaction(signo, info, context);
+		}
+		else if (s_prev_sigurg.sa_handler != SIG_DFL && s_prev_sigurg.sa_handler != SIG_IGN)
+		{
+			s_prev_sigurg.sa_handler(signo);
+		}
+	}
+
+	void Scheduler::WatchdogSignalHandler(int signo, siginfo_t *info, void *context)
+	{
+		// 看门狗的请求: 本进程用tgkill发给调度器工作线程, 并且该线程有未处理的采集请求
+		Scheduler *scheduler = t_scheduler;
+		int index = t_worker;
+		if (!info || info->si_code != SI_TKILL || info->si_pid != getpid() ||
+			!scheduler || index < 0 || index >= (int)scheduler->m_workers.size())
+		{
+			ChainSigurg(signo, info, context);
+			return;
+		}
+		int saved_errno = errno;
+		Worker &worker = *scheduler->m_workers[index];
+		int state = 1;
+		if (!worker.sample_state.compare_exchange_strong(state, 2, std::memory_order_acquire))
+		{
+			errno = saved_errno;
+			ChainSigurg(signo, info, context);
+			return;
+		}
+		{
+			worker.sample_fiber = Fiber::GetFiberId();
+			worker.sample_depth = backtrace(worker.sample_frames, kMaxFrames);
+			// 超时的任务仍在运行 -> 要求它在下一个安全点让出
+			if (worker.sample_preempt && worker.task_start.load(std::memory_order_relaxed) &&
+				worker.task_seq.load(std::memory_order_relaxed) == worker.sample_seq)
+			{
+				t_preempt = 1;
+			}
+			worker.sample_state.store(3, std::memory_order_release);
+		}
+		errno = saved_errno;
 	}
 
 }
@@ -4,7 +4,14 @@
 #include "hook.h"
 #include "fiber.h"
 #include "thread.h"
+#include "ring_buffer.h"
+#include "work_stealing_queue.h"
 
+#include <signal.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -13,42 +20,221 @@ namespace corlib {
 class Scheduler
 {
 public:
-	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler");
+	// 任务优先级 -> 高优先级任务(健康检查、心跳、小请求)优先于普通任务出队
+	enum Priority
+	{
+		PRIORITY_NORMAL = 0,
+		PRIORITY_HIGH = 1
+	};
+	static const int PRIORITY_COUNT = 2;
+
+	// 一个优先级的排队延迟(入队到开始运行)统计, 单位纳秒; 分位数为直方图桶的上界
+	struct QueueDelayStats
+	{
+		uint64_t count = 0;
+		uint64_t mean_ns = 0;
+		uint64_t p50_ns = 0;
+		uint64_t p99_ns = 0;
+		uint64_t max_ns = 0;
+	};
+
+	// 延迟直方图(排队延迟, 也用于阻塞任务线程池的统计) -> 每个2的幂区间再分为8个桶, 误差约12%
+	struct DelayHistogram
+	{
+		static const int kSubBuckets = 8;
+		static const int kBuckets = 64 * kSubBuckets;
+		std::atomic<uint64_t> buckets[kBuckets] = {};
+		std::atomic<uint64_t> count = {0};
+		std::atomic<uint64_t> sum = {0};
+		std::atomic<uint64_t> max = {0};
+
+		void record(uint64_t ns);
+		QueueDelayStats stats() const;
+		void reset();
+	};
+
+	// 看门狗发现的运行超时的任务
+	struct OverrunReport
+	{
+		int worker = -1;
+		int thread_id = -1;
+		// 采集调用栈时线程上运行的协程id(内联运行的回调为调度协程的id), 线程没有及时响应信号时为0
+		uint64_t fiber_id = 0;
+		// 任务已经连续运行的时间
+		uint64_t running_ms = 0;
+		// 是否要求了任务在下一个安全点让出
+		bool preempt = false;
+		// 信号处理函数中采集的调用栈(backtrace的返回地址, 从信号帧开始)
+		std::vector<void*> frames;
+	};
+
+	// 弹性线程池的状态, 线程数的计法与构造函数的threads相同(使用调用线程时包括调用线程)
+	struct WorkerPoolStats
+	{
+		size_t threads = 0;
+		size_t min_threads = 0;
+		size_t max_threads = 0;
+		// 累计扩容(创建线程)和收缩(空闲线程退出)的次数
+		uint64_t grown = 0;
+		uint64_t retired = 0;
+	};
+
+	// min_threads为0时线程数固定为threads; 否则为弹性线程池: start()只创建min_threads个线程,
+	// 任务排队延迟超过阈值时逐个增加到threads个, 空闲太久的线程退出直到剩下min_threads个
+	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler", size_t min_threads = 0);
 	virtual ~Scheduler();
 	
 	const std::string& getName() const {return m_name;}
 
+	// 设置调度器自己创建的协程(回调任务协程、idle协程)的栈大小和栈来源
+	// stacksize为0表示使用Fiber的默认大小, MMAP模式下stacksize是预留的地址空间大小
+	void setStackOptions(size_t stacksize, StackAllocator::Mode mode);
+	size_t getStackSize() const {return m_stackSize;}
+	StackAllocator::Mode getStackMode() const {return m_stackMode;}
+
+	// 回调任务协程改为在count个大小为stacksize的共享栈上轮流运行, count为0表示关闭
+	// 适合大量长时间挂起的连接协程: 挂起时只保存实际使用的栈, 代价是切换时的栈拷贝
+	void setSharedStack(size_t count, size_t stacksize);
+
+	// 回调任务是否直接在调度协程上运行(默认开启, 使用共享栈时不生效)
+	// 回调到达挂起点(hook的I/O、sleep、FiberSemaphore::wait、Future::wait、yield)或调用Fiber::GetThis()时才提升为独立的协程,
+	// 不挂起的短任务省去一次协程的复用/创建和两次上下文切换
+	void setInlineCallbacks(bool enabled) {m_inlineCallbacks = enabled;}
+	bool getInlineCallbacks() const {return m_inlineCallbacks;}
+
+	// 工作线程放置: 第i个工作线程(使用调用线程时下标0为调用线程)绑定到cpus[i % cpus.size()],
+	// 此后它的协程栈和任务队列从该CPU所在的NUMA节点分配; cpus为空取消绑定
+	// 已启动的线程通过信箱在下一次取任务时生效, 还没启动的线程在启动时生效
+	void setCpuAffinity(const std::vector<int>& cpus);
+	// 把工作线程轮流分到各个NUMA节点上, 线程可以在节点内的所有CPU上运行, 内存从本节点分配
+	void setNumaSpread();
+
+	// 高优先级任务连续出队burst个之后, 如果有普通任务则先运行一个 -> 防止普通任务饿死(默认16)
+	void setPriorityBurst(uint32_t burst) {m_priorityBurst = burst ? burst : 1;}
+	uint32_t getPriorityBurst() const {return m_priorityBurst;}
+
+	// 是否统计各优先级的排队延迟(默认关闭, 开启后每个任务入队和出队时各读一次时钟)
+	void setQueueDelayMetrics(bool enabled) {m_queueDelayMetrics = enabled;}
+	bool getQueueDelayMetrics() const {return m_queueDelayMetrics;}
+	QueueDelayStats getQueueDelay(Priority priority) const;
+	void resetQueueDelay();
+
+	// 累计唤醒空闲线程的次数
+	uint64_t getWakeupCount() const {return m_wakeupCount;}
+
+	// 看门狗: 任务连续运行(中间没有挂起)超过slice_ms毫秒时, 向所在线程发送SIGURG采集调用栈并报告, 每个任务只报告一次
+	// preempt为true时还要求该任务在下一个安全点(hook的I/O函数、PreemptPoint)让出并排到全局队列末尾,
+	// 不经过安全点的纯计算循环无法被打断, 只能被报告; slice_ms为0关闭
+	// 第一次开启时安装SIGURG处理函数, 其他来源的SIGURG(如带外数据)转交给在此之前安装的处理函数;
+	// 之后再安装SIGURG处理函数会使看门狗无法采集调用栈
+	void setWatchdog(uint64_t slice_ms, bool preempt = false);
+	uint64_t getWatchdogSlice() const {return m_watchdogSlice;}
+	// 设置报告的处理函数(在看门狗线程上调用), 默认输出到标准错误(符号化调用栈需要链接时加-rdynamic)
+	void setOverrunHandler(std::function<void(const OverrunReport&)> handler);
+	// 累计报告的超时任务数
+	uint64_t getOverrunCount() const {return m_overrunCount;}
+
+	// 弹性线程池: 任务排队超过grow_delay_ms(或者有任务排队而所有线程都没有进展)时增加一个线程,
+	// 线程连续空闲retire_idle_ms后退出(默认10ms和5000ms); 固定线程数时不生效
+	void setElasticOptions(uint64_t grow_delay_ms, uint64_t retire_idle_ms);
+	WorkerPoolStats getWorkerPoolStats() const;
+
 public:	
 	// 获取正在运行的调度器
 	static Scheduler* GetThis();
 
+	// 当前任务让出执行权并排到全局队列末尾, 不在调度器的任务中时什么也不做
+	static void Yield();
+	// 安全点: 当前任务被看门狗要求让出时调用Yield, 否则立即返回 -> 长时间的计算循环中可以主动调用
+	static void PreemptPoint();
+
 protected:
 	// 设置正在运行的调度器
 	void SetThis();
 	
 public:	
 	// 添加任务到任务队列
+	// 指定线程的任务放入该线程的信箱(不区分优先级), 高优先级任务放入全局的高优先级队列,
+	// 本调度器的工作线程投递的任务放入该线程的本地队列, 其他线程投递的任务放入全局队列
     template <class FiberOrCb>
-    void scheduleLock(FiberOrCb fc, int thread = -1) 
+    void scheduleLock(FiberOrCb fc, int thread = -1, Priority priority = PRIORITY_NORMAL) 
     {
-    	bool need_tickle;
-    	{
-    		std::lock_guard<std::mutex> lock(m_mutex);
-    		// empty ->  all thread is idle -> need to be waken up
-    		need_tickle = m_tasks.empty();
-	        
-	        ScheduleTask task(fc, thread);
-	        if (task.fiber || task.cb) 
-	        {
-	            m_tasks.push_back(task);
-	        }
-    	}
-    	
-    	if(need_tickle)
-    	{
-    		tickle();
-    	}
+        ScheduleTask task(fc, thread);
+        if (!task.fiber && !task.cb) 
+        {
+            return;
+        }
+        markEnqueued(task, priority);
+        if (thread != -1 && pushPinned(task))
+        {
+            return;
+        }
+        if (priority == PRIORITY_HIGH)
+        {
+            pushHigh(task);
+            return;
+        }
+        if (pushLocal(task))
+        {
+            return;
+        }
+        pushGlobal(task);
     }
+
+	// 批量添加任务 -> 只加一次锁, 最多唤醒一次空闲线程; 区间中的元素(协程或回调)被移走, 不支持指定线程
+	template <class InputIt>
+	void scheduleBatch(InputIt begin, InputIt end, Priority priority = PRIORITY_NORMAL)
+	{
+		size_t count = 0;
+		if (priority == PRIORITY_NORMAL && getWorkerIndex() >= 0)
+		{
+			// 本调度器的工作线程 -> 放入本地队列, 不需要加锁
+			for (; begin != end; ++begin)
+			{
+				ScheduleTask task(&*begin, -1);
+				markEnqueued(task, priority);
+				if ((task.fiber || task.cb) && pushLocal(task, false))
+				{
+					count++;
+				}
+			}
+			if (count)
+			{
+				tickle();
+			}
+			return;
+		}
+
+		bool need_tickle;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			RingBuffer<ScheduleTask> &queue = priority == PRIORITY_HIGH ? m_highTasks : m_tasks;
+			std::atomic<size_t> &queued = priority == PRIORITY_HIGH ? m_highTaskCount : m_globalTaskCount;
+			need_tickle = queue.empty();
+			for (; begin != end; ++begin)
+			{
+				ScheduleTask task(&*begin, -1);
+				if (task.fiber || task.cb)
+				{
+					markEnqueued(task, priority);
+					queue.push(std::move(task));
+					queued++;
+					m_pendingTaskCount++;
+					count++;
+				}
+			}
+		}
+
+		if (need_tickle && count)
+		{
+			tickle();
+		}
+	}
+
+	// 任务协程挂起等待调度器之外的线程唤醒(如Future等待OffloadPool的结果)之前调用begin, 恢复运行之后调用end
+	// 计数不为0时stopping()返回false -> 调度器在这些协程被唤醒之前不会关闭
+	void beginExternalWait() {m_externalWaitCount++;}
+	void endExternalWait() {m_externalWaitCount--;}
 	
 	// 启动线程池
 	virtual void start();
@@ -69,33 +255,75 @@ protected:
 
 	bool hasIdleThreads() {return m_idleThreadCount>0;}
 
+	// 当前线程在本调度器中的工作线程下标, 不是本调度器的工作线程返回-1
+	int getWorkerIndex() const;
+	// 唤醒指定的工作线程(它的信箱中有了任务), 默认唤醒任意一个空闲线程
+	virtual void tickleWorker(size_t worker);
+
+	// 是否有空闲线程正在寻找任务(自旋中, 或被唤醒后还没有取过任务) -> 它会看到新投递的任务, tickle可以省略
+	bool hasSearchingThreads() const {return m_searchingCount > 0;}
+	// 唤醒一个线程之前调用: 被唤醒的线程在下一次取任务之前算作寻找任务的线程, 期间的tickle被合并
+	void beginWakeup();
+	// 被唤醒的工作线程认领beginWakeup增加的计数, 在它下一次取任务之后释放
+	void claimWakeup();
+
+	// 当前工作线程停车, 直到被unparkWorker唤醒、超时或者已经有可以运行的任务, 返回是否被唤醒
+	bool parkWorker(uint64_t timeout_ms);
+	// 停车超时后调用: 弹性线程池中当前线程空闲足够久且线程数多于下限时登记退出, 返回true时idle协程应当直接结束
+	bool retireWorker();
+	// 唤醒一个停车的工作线程, 没有停车的线程返回false
+	bool unparkWorker();
+	// 唤醒停车的worker, 它没有停车返回false
+	bool unparkWorker(size_t worker);
+	// 工作线程worker是否有可以运行(或窃取)的任务
+	bool hasPendingTasks(size_t worker) const;
+
 private:
+	// 看门狗采集的调用栈的最大深度
+	static const int kMaxFrames = 32;
+
 	// 任务
 	struct ScheduleTask
 	{
-		std::shared_ptr<Fiber> fiber;
+		// 侵入式引用 -> 入队出队只移动指针, 不访问shared_ptr的控制块
+		FiberRef fiber;
 		std::function<void()> cb;
 		int thread; // 指定任务需要运行的线程id
+		int priority = PRIORITY_NORMAL;
+		// 入队时刻(单调时钟纳秒), 0表示不统计排队延迟
+		uint64_t enqueued = 0;
 
 		ScheduleTask()
 		{
-			fiber = nullptr;
 			cb = nullptr;
 			thread = -1;
 		}
 
 		ScheduleTask(std::shared_ptr<Fiber> f, int thr)
 		{
-			fiber = f;
+			fiber = FiberRef(f);
 			thread = thr;
 		}
 
 		ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
 		{
-			fiber.swap(*f);
+			fiber = FiberRef(*f);
+			f->reset();
 			thread = thr;
 		}	
 
+		ScheduleTask(FiberRef f, int thr)
+		{
+			fiber.swap(f);
+			thread = thr;
+		}
+
+		ScheduleTask(FiberRef* f, int thr)
+		{
+			fiber.swap(*f);
+			thread = thr;
+		}
+
 		ScheduleTask(std::function<void()> f, int thr)
 		{
 			cb = f;
@@ -110,28 +338,196 @@ private:
 
 		void reset()
 		{
-			fiber = nullptr;
+			fiber.reset();
 			cb = nullptr;
 			thread = -1;
+			priority = PRIORITY_NORMAL;
+			enqueued = 0;
 		}	
 	};
 
+	void markEnqueued(ScheduleTask &task, Priority priority)
+	{
+		task.priority = priority;
+		// 弹性线程池根据排队延迟扩容
+		if (m_queueDelayMetrics.load(std::memory_order_relaxed) || m_elastic)
+		{
+			task.enqueued = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+	}
+
+	// 工作线程的任务队列和停车状态
+	// 按页对齐 -> 可以整页迁移到工作线程所在的NUMA节点而不牵连其他数据
+	struct alignas(4096) Worker
+	{
+		// 所在线程的id, 线程还没有启动为-1
+		std::atomic<int> thread_id = {-1};
+		// 本线程投递的任务 -> 本线程后进先出地取出, 其他线程先进先出地窃取
+		WorkStealingQueue<ScheduleTask> local;
+		// 信箱 -> 指定在本线程运行的任务
+		std::mutex mailbox_mutex;
+		RingBuffer<ScheduleTask> mailbox;
+		std::atomic<size_t> mailbox_count = {0};
+		// 停车 -> notified由park_mutex保护, parked由Scheduler::m_parkMutex保护
+		std::mutex park_mutex;
+		std::condition_variable park_cond;
+		bool notified = false;
+		bool parked = false;
+		// 被唤醒(或自旋等到任务)后还没有取过任务 -> 持有m_searchingCount中的一个计数, 只由本线程访问
+		bool searching = false;
+		// 看门狗: 当前任务开始运行的时刻(毫秒, 0表示没有在运行任务)
+		std::atomic<uint64_t> task_start = {0};
+		// 取到的任务数 -> 只由本线程写, 看门狗区分先后运行的任务, 监控线程据此判断线程有没有进展
+		std::atomic<uint64_t> task_seq = {0};
+		// 弹性线程池: 开始空闲的时刻和当时的任务数, 只由本线程访问
+		uint64_t idle_since = 0;
+		uint64_t idle_seq = 0;
+		// 调度循环已经结束, 线程可以被回收
+		std::atomic<bool> exited = {false};
+		// 看门狗已经处理过的任务序号, 只由看门狗线程访问
+		uint64_t watched_seq = 0;
+		// 调用栈采样 -> sample_state: 0空闲 1已请求 2正在采集 3已采集, 其余字段只在1和3之间由信号处理函数写
+		std::atomic<int> sample_state = {0};
+		uint64_t sample_seq = 0;
+		bool sample_preempt = false;
+		uint64_t sample_fiber = 0;
+		int sample_depth = 0;
+		void *sample_frames[kMaxFrames];
+	};
+
+	// 工作线程的放置方式
+	struct Placement
+	{
+		// 允许运行的CPU, 为空表示不限制
+		std::vector<int> cpus;
+		// 内存所在的NUMA节点, -1表示不指定
+		int node = -1;
+	};
+
+	// 工作线程的调度循环状态 -> 被同一线程上先后接替的调度协程共享
+	struct ThreadLoop
+	{
+		int thread_id = -1;
+		// 工作线程的下标
+		size_t worker = 0;
+		// 取任务的次数 -> 决定何时优先检查全局队列以及从哪个线程开始窃取
+		uint32_t tick = 0;
+		// 连续取出的高优先级任务数
+		uint32_t high_streak = 0;
+		// 空闲协程
+		std::shared_ptr<Fiber> idle_fiber;
+		// 不内联运行时用于执行回调任务的协程
+		std::shared_ptr<Fiber> cb_fiber;
+		// 回调被提升时创建接替的调度协程
+		std::function<std::shared_ptr<Fiber>()> promote;
+	};
+
+	// 调度循环 -> 运行在调度协程上, 内联回调被提升后由接替的调度协程重新进入
+	void runLoop(std::shared_ptr<ThreadLoop> loop);
+
+	// 把任务放入线程task.thread的信箱并唤醒它, 不是本调度器的线程返回false
+	bool pushPinned(ScheduleTask &task);
+	// 当前线程是本调度器的工作线程 -> 把任务放入它的本地队列并唤醒空闲线程(wake为true时), 否则返回false
+	bool pushLocal(ScheduleTask &task, bool wake = true);
+	// 把高优先级任务放入全局的高优先级队列并唤醒空闲线程
+	void pushHigh(ScheduleTask &task);
+	// 把任务放入全局队列, 队列原来为空时唤醒空闲线程
+	void pushGlobal(ScheduleTask &task);
+	// 协程的共享栈正被其他线程上的协程占用 -> 重新排队(指定线程的回到信箱, 其余排到队列末尾), 不阻塞本线程
+	void requeueStackBusy(FiberRef &fiber, int thread, Priority priority);
+	// 依次从信箱、高优先级队列、本地队列(后进先出)、全局队列、其他线程的本地队列(先进先出)取出一个任务
+	bool nextTask(ThreadLoop &loop, ScheduleTask &task);
+	// 从高优先级队列取出一个任务
+	bool popHigh(ScheduleTask &task);
+	// 取出普通任务
+	bool nextNormalTask(ThreadLoop &loop, ScheduleTask &task);
+	// 记录任务的排队延迟
+	void recordDelay(const ScheduleTask &task);
+	// 从全局队列取出一个任务, 并按积压数量顺带取出一批任务放入worker的本地队列
+	bool popGlobal(size_t worker, ScheduleTask &task);
+	// 记录放置方式并应用到已启动的工作线程
+	void applyPlacement(const std::vector<Placement> &placement);
+	// 在工作线程index上运行: 设置CPU亲和性和内存策略, 并把它的队列迁移到所在节点
+	void placeWorker(size_t index, const Placement &placement);
+	// 空闲时自旋一小段时间等待任务, 返回是否等到
+	bool spinForTasks(size_t worker);
+	// 从worker的信箱取出一个任务
+	bool popMailbox(size_t worker, ScheduleTask &task);
+	// 通知停车的worker醒来
+	void notifyWorker(size_t worker);
+	// 监控线程函数: 每半个时间片检查一次各工作线程上的任务, 每半个扩容阈值检查一次排队情况
+	void monitorLoop();
+	// 报告运行超过slice_ms的任务
+	void checkOverruns(uint64_t slice_ms);
+	// 在m_threads[index]上创建工作线程, 调用者持有m_mutex
+	void startThread(size_t index);
+	// 弹性线程池增加一个工作线程, 已达上限或者正在关闭时返回false
+	bool spawnWorker();
+	// 监控线程检查是否需要扩容
+	void checkGrowth();
+	// 启动监控线程(看门狗和弹性线程池共用), 调用者持有m_monitorMutex
+	void startMonitor();
+	// 关闭监控线程
+	void stopMonitor();
+	// SIGURG处理函数: 为看门狗采集当前线程的调用栈, 不是看门狗发出的SIGURG转交给之前安装的处理函数
+	static void WatchdogSignalHandler(int signo, siginfo_t *info, void *context);
+
 private:
 	std::string m_name;
 	// 互斥锁 -> 保护任务队列
 	std::mutex m_mutex;
 	// 线程池
 	std::vector<std::shared_ptr<Thread>> m_threads;
-	// 任务队列
-	std::vector<ScheduleTask> m_tasks;
-	// 存储工作线程的线程id
-	std::vector<int> m_threadIds;
-	// 需要额外创建的线程数
+	// 全局任务队列 -> 外部线程投递的任务
+	RingBuffer<ScheduleTask> m_tasks;
+	// 全局队列中的任务数 -> 不加锁判断全局队列是否为空
+	std::atomic<size_t> m_globalTaskCount = {0};
+	// 高优先级任务队列(由m_mutex保护)及其任务数
+	RingBuffer<ScheduleTask> m_highTasks;
+	std::atomic<size_t> m_highTaskCount = {0};
+	std::atomic<uint32_t> m_priorityBurst = {16};
+	// 排队延迟统计
+	std::atomic<bool> m_queueDelayMetrics = {false};
+	DelayHistogram m_queueDelay[PRIORITY_COUNT];
+	// 每个工作线程(包括调用线程)的任务队列, 使用调用线程时下标0为调用线程
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	// 每个工作线程的放置方式(由m_mutex保护), 为空表示不放置
+	std::vector<Placement> m_placement;
+	// 所有本地队列中的任务数
+	std::atomic<size_t> m_localTaskCount = {0};
+	// 所有信箱中的任务数
+	std::atomic<size_t> m_pinnedTaskCount = {0};
+	// 保护停车的工作线程列表
+	std::mutex m_parkMutex;
+	// 停车的工作线程下标
+	std::vector<size_t> m_parked;
+	// 需要额外创建的线程数(弹性线程池的上限)
 	size_t m_threadCount = 0;
+	// 弹性线程池: 额外创建的线程数的下限、当前存活的线程数(已登记退出的不算)和伸缩次数
+	bool m_elastic = false;
+	size_t m_minThreadCount = 0;
+	std::atomic<size_t> m_liveThreadCount = {0};
+	std::atomic<uint64_t> m_growCount = {0};
+	std::atomic<uint64_t> m_retireCount = {0};
+	std::atomic<uint64_t> m_growDelayMs = {10};
+	std::atomic<uint64_t> m_retireIdleMs = {5000};
+	// 有任务的排队延迟超过了扩容阈值, 由监控线程取走
+	std::atomic<bool> m_delayExceeded = {false};
+	// 监控线程上次看到的所有线程的任务数之和及其变化的时刻
+	uint64_t m_lastProgress = 0;
+	uint64_t m_progressSince = 0;
 	// 活跃线程数
 	std::atomic<size_t> m_activeThreadCount = {0};
+	// 排队和正在运行的任务数 -> 入队时增加、任务结束时减少, 在队列之间移动不变; 为0才可以关闭
+	std::atomic<size_t> m_pendingTaskCount = {0};
+	// 挂起等待外部线程唤醒的协程数
+	std::atomic<size_t> m_externalWaitCount = {0};
 	// 空闲线程数
 	std::atomic<size_t> m_idleThreadCount = {0};
+	// 正在寻找任务的空闲线程数(自旋中, 或被唤醒后还没有取过任务)
+	std::atomic<size_t> m_searchingCount = {0};
+	// 唤醒次数
+	std::atomic<uint64_t> m_wakeupCount = {0};
 
 	// 主线程是否用作工作线程
 	bool m_useCaller;
@@ -140,7 +536,24 @@ private:
 	// 如果是 -> 记录主线程的线程id
 	int m_rootThread = -1;
 	// 是否正在关闭
-	bool m_stopping = false;	
+	std::atomic<bool> m_stopping = {false};	
+	// 调度器创建的协程的栈大小和栈来源
+	std::atomic<size_t> m_stackSize = {0};
+	std::atomic<StackAllocator::Mode> m_stackMode = {StackAllocator::MALLOC};
+	// 共享栈池 -> 为空表示使用私有栈
+	std::shared_ptr<SharedStackPool> m_sharedStacks;
+	// 回调任务是否在调度协程上内联运行
+	std::atomic<bool> m_inlineCallbacks = {true};
+	// 看门狗的时间片(毫秒, 0表示关闭)、是否要求超时的任务让出和累计报告数
+	std::atomic<uint64_t> m_watchdogSlice = {0};
+	std::atomic<bool> m_watchdogPreempt = {false};
+	std::atomic<uint64_t> m_overrunCount = {0};
+	// 监控线程, 由m_monitorMutex保护
+	std::mutex m_monitorMutex;
+	std::condition_variable m_monitorCond;
+	std::shared_ptr<Thread> m_monitorThread;
+	bool m_monitorStop = false;
+	std::function<void(const OverrunReport&)> m_overrunHandler;
 };
 
 }
@@ -0,0 +1,473 @@
+#include "stack_allocator.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <string.h>
+
+namespace corlib
+{
+
+	// 每个级别的缓存上限
+	static std::atomic<size_t> s_thread_limit{16};
+	static std::atomic<size_t> s_global_limit{256};
+
+	// 统计计数器
+	static std::atomic<uint64_t> s_local_hits{0};
+	static std::atomic<uint64_t> s_global_hits{0};
+	static std::atomic<uint64_t> s_misses{0};
+	static std::atomic<uint64_t> s_local_frees{0};
+	static std::atomic<uint64_t> s_global_frees{0};
+	static std::atomic<uint64_t> s_releases{0};
+
+	// 返回size所属级别, 不属于任何级别返回-1
+	static int SizeClass(size_t size)
+	{
+		size_t cls_size = StackAllocator::kMinClassSize;
+		for (size_t i = 0; i < StackAllocator::kClassCount; i++)
+		{
+			if (size == cls_size)
+			{
+				return (int)i;
+			}
+			cls_size <<= 1;
+		}
+		return -1;
+	}
+
+	// 向系统申请栈
+	static void *SystemAlloc(size_t size, StackAllocator::Mode mode)
+	{
+		if (mode == StackAllocator::MALLOC)
+		{
+			return malloc(size);
+		}
+
+		// 多预留一页作为保护页, 只预留地址空间, 不预先提交物理内存
+		size_t page = StackAllocator::PageSize();
+		void *base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			return nullptr;
+		}
+		// 栈向低地址增长 -> 保护页放在最低处, 栈溢出时触发SIGSEGV而不是踩坏相邻内存
+		if (mprotect(base, page, PROT_NONE))
+		{
+			munmap(base, size + page);
+			return nullptr;
+		}
+		return (char *)base + page;
+	}
+
+	// 把栈还给系统
+	static void SystemFree(void *stack, size_t size, StackAllocator::Mode mode)
+	{
+		if (mode == StackAllocator::MALLOC)
+		{
+			free(stack);
+			return;
+		}
+		size_t page = StackAllocator::PageSize();
+		munmap((char *)stack - page, size + page);
+	}
+
+	// 归还空闲栈已提交的物理页, 只保留栈顶一页(协程开始运行就会用到); 之后访问时由内核重新提交零页
+	// MALLOC模式的内存由malloc管理 -> 不处理
+	static void ReleasePages(void *stack, size_t size, StackAllocator::Mode mode)
+	{
+		size_t page = StackAllocator::PageSize();
+		if (mode != StackAllocator::MMAP || size <= page)
+		{
+			return;
+		}
+		madvise(stack, size - page, MADV_DONTNEED);
+	}
+
+	// 按模式和级别划分的空闲栈
+	struct FreeLists
+	{
+		std::vector<void *> lists[StackAllocator::MODE_COUNT][StackAllocator::kClassCount];
+	};
+
+	// 全局池 -> 线程退出或线程缓存溢出时的去处
+	struct GlobalStackPool
+	{
+		std::mutex mutex;
+		// 按NUMA节点分开(-1表示没有指定节点) -> 线程只复用自己节点上的栈
+		std::map<int, FreeLists> nodes;
+
+		// 进程退出时线程缓存可能晚于静态对象析构 -> 不释放, 交给操作系统回收
+		static GlobalStackPool *GetInstance()
+		{
+			static GlobalStackPool *pool = new GlobalStackPool();
+			return pool;
+		}
+	};
+
+	// 线程缓存是否已析构 -> 线程退出之后析构的协程直接把栈还给全局池
+	static thread_local bool t_cache_destroyed = false;
+
+	// 线程缓存
+	struct ThreadStackCache
+	{
+		std::vector<void *> free_lists[StackAllocator::MODE_COUNT][StackAllocator::kClassCount];
+		// 本线程所在的NUMA节点
+		int node = -1;
+
+		// 线程退出 -> 把缓存的栈归还给全局池
+		~ThreadStackCache()
+		{
+			t_cache_destroyed = true;
+			flushAll();
+		}
+
+		void flushAll()
+		{
+			for (int mode = 0; mode < StackAllocator::MODE_COUNT; mode++)
+			{
+				for (size_t i = 0; i < StackAllocator::kClassCount; i++)
+				{
+					flush((StackAllocator::Mode)mode, i, free_lists[mode][i].size());
+				}
+			}
+		}
+
+		// 从线程缓存移动count个栈到全局池, 全局池满了则释放
+		void flush(StackAllocator::Mode mode, size_t cls, size_t count)
+		{
+			std::vector<void *> &local = free_lists[mode][cls];
+			GlobalStackPool *pool = GlobalStackPool::GetInstance();
+			size_t limit = s_global_limit.load(std::memory_order_relaxed);
+			// 进入全局池的栈不会很快被本线程复用 -> 先归还深调用提交的物理页(必须在放入全局池之前, 之后它可能已被别的线程使用)
+			size_t size = StackAllocator::kMinClassSize << cls;
+			for (size_t i = 0; i < count && i < local.size(); i++)
+			{
+				ReleasePages(local[local.size() - 1 - i], size, mode);
+			}
+			std::vector<void *> overflow;
+			{
+				std::lock_guard<std::mutex> lock(pool->mutex);
+				std::vector<void *> &global = pool->nodes[node].lists[mode][cls];
+				while (count-- > 0 && !local.empty())
+				{
+					if (global.size() < limit)
+					{
+						global.push_back(local.back());
+					}
+					else
+					{
+						overflow.push_back(local.back());
+					}
+					local.pop_back();
+				}
+			}
+			for (void *stack : overflow)
+			{
+				SystemFree(stack, size, mode);
+			}
+			s_releases.fetch_add(overflow.size(), std::memory_order_relaxed);
+		}
+
+		// 从全局池取一批栈到线程缓存, 返回是否取到
+		bool refill(StackAllocator::Mode mode, size_t cls)
+		{
+			std::vector<void *> &local = free_lists[mode][cls];
+			GlobalStackPool *pool = GlobalStackPool::GetInstance();
+			size_t batch = std::max<size_t>(1, s_thread_limit.load(std::memory_order_relaxed) / 2);
+
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			std::vector<void *> &global = pool->nodes[node].lists[mode][cls];
+			while (batch-- > 0 && !global.empty())
+			{
+				local.push_back(global.back());
+				global.pop_back();
+			}
+			return !local.empty();
+		}
+	};
+
+	static thread_local ThreadStackCache t_stack_cache;
+
+	size_t StackAllocator::PageSize()
+	{
+		static size_t page = sysconf(_SC_PAGESIZE);
+		return page;
+	}
+
+	size_t StackAllocator::RoundUp(size_t size)
+	{
+		if (size > kMaxClassSize)
+		{
+			size_t page = PageSize();
+			return (size + page - 1) / page * page;
+		}
+		size_t cls_size = kMinClassSize;
+		while (cls_size < size)
+		{
+			cls_size <<= 1;
+		}
+		return cls_size;
+	}
+
+	void *StackAllocator::Alloc(size_t size, Mode mode)
+	{
+		int cls = SizeClass(size);
+		if (cls >= 0 && !t_cache_destroyed)
+		{
+			std::vector<void *> &local = t_stack_cache.free_lists[mode][cls];
+			if (!local.empty())
+			{
+				s_local_hits.fetch_add(1, std::memory_order_relaxed);
+			}
+			else if (t_stack_cache.refill(mode, cls))
+			{
+				s_global_hits.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			if (!local.empty())
+			{
+				void *stack = local.back();
+				local.pop_back();
+				return stack;
+			}
+		}
+
+		s_misses.fetch_add(1, std::memory_order_relaxed);
+		return SystemAlloc(size, mode);
+	}
+
+	void StackAllocator::Dealloc(void *stack, size_t size, Mode mode)
+	{
+		if (!stack)
+		{
+			return;
+		}
+
+		int cls = SizeClass(size);
+		if (cls < 0 || t_cache_destroyed)
+		{
+			s_releases.fetch_add(1, std::memory_order_relaxed);
+			SystemFree(stack, size, mode);
+			return;
+		}
+
+		std::vector<void *> &local = t_stack_cache.free_lists[mode][cls];
+		size_t limit = s_thread_limit.load(std::memory_order_relaxed);
+		local.push_back(stack);
+		if (local.size() > limit)
+		{
+			// 线程缓存已满 -> 只留一半, 其余挪到全局池
+			s_global_frees.fetch_add(1, std::memory_order_relaxed);
+			t_stack_cache.flush(mode, cls, local.size() - limit / 2);
+		}
+		else
+		{
+			s_local_frees.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	void StackAllocator::SetThreadNode(int node)
+	{
+		if (t_cache_destroyed || t_stack_cache.node == node)
+		{
+			return;
+		}
+		// 已缓存的栈可能在原来的节点上 -> 还给原来节点的全局池
+		t_stack_cache.flushAll();
+		t_stack_cache.node = node;
+	}
+
+	void StackAllocator::SetLimits(size_t per_thread, size_t global)
+	{
+		s_thread_limit = per_thread;
+		s_global_limit = global;
+	}
+
+	StackAllocator::Stats StackAllocator::GetStats()
+	{
+		Stats stats;
+		stats.local_hits = s_local_hits.load(std::memory_order_relaxed);
+		stats.global_hits = s_global_hits.load(std::memory_order_relaxed);
+		stats.misses = s_misses.load(std::memory_order_relaxed);
+		stats.local_frees = s_local_frees.load(std::memory_order_relaxed);
+		stats.global_frees = s_global_frees.load(std::memory_order_relaxed);
+		stats.releases = s_releases.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void StackAllocator::DumpStats(std::ostream &os)
+	{
+		Stats stats = GetStats();
+		os << "StackAllocator: local_hits=" << stats.local_hits
+		   << " global_hits=" << stats.global_hits
+		   << " misses=" << stats.misses
+		   << " local_frees=" << stats.local_frees
+		   << " global_frees=" << stats.global_frees
+		   << " releases=" << stats.releases << std::endl;
+	}
+
+	// 栈高水位线
+	static std::atomic<bool> s_watermark_enabled{false};
+	static const uint64_t kStackCanary = 0xC0DEFEEDC0DEFEEDull;
+
+	struct WatermarkRegistry
+	{
+		std::mutex mutex;
+		std::map<size_t, StackWatermark::Histogram> histograms;
+
+		static WatermarkRegistry *GetInstance()
+		{
+			static WatermarkRegistry *registry = new WatermarkRegistry();
+			return registry;
+		}
+	};
+
+	void StackWatermark::SetEnabled(bool enabled)
+	{
+		s_watermark_enabled = enabled;
+	}
+
+	bool StackWatermark::IsEnabled()
+	{
+		return s_watermark_enabled.load(std::memory_order_relaxed);
+	}
+
+	void StackWatermark::Paint(void *stack, size_t size)
+	{
+		uint64_t *p = (uint64_t *)stack;
+		for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+		{
+			p[i] = kStackCanary;
+		}
+	}
+
+	size_t StackWatermark::Measure(const void *stack, size_t size)
+	{
+		// 栈向低地址增长 -> 从栈底向上找到第一个不是填充值的位置
+		const uint64_t *p = (const uint64_t *)stack;
+		size_t words = size / sizeof(uint64_t);
+		size_t i = 0;
+		while (i < words && p[i] == kStackCanary)
+		{
+			i++;
+		}
+		if (i == words)
+		{
+			return 0;
+		}
+
+		const unsigned char *bytes = (const unsigned char *)&p[i];
+		const unsigned char *canary = (const unsigned char *)&kStackCanary;
+		size_t offset = i * sizeof(uint64_t);
+		for (size_t j = 0; j < sizeof(uint64_t) && bytes[j] == canary[j]; j++)
+		{
+			offset++;
+		}
+		return size - offset;
+	}
+
+	void StackWatermark::Record(size_t stacksize, size_t used)
+	{
+		size_t bucket = 0;
+		while (bucket + 1 < kBucketCount && used > ((size_t)1024 << bucket))
+		{
+			bucket++;
+		}
+
+		WatermarkRegistry *registry = WatermarkRegistry::GetInstance();
+		std::lock_guard<std::mutex> lock(registry->mutex);
+		Histogram &histogram = registry->histograms[stacksize];
+		histogram.count++;
+		histogram.max_used = std::max(histogram.max_used, used);
+		histogram.buckets[bucket]++;
+	}
+
+	StackWatermark::Histogram StackWatermark::GetHistogram(size_t stacksize)
+	{
+		WatermarkRegistry *registry = WatermarkRegistry::GetInstance();
+		std::lock_guard<std::mutex> lock(registry->mutex);
+		auto it = registry->histograms.find(stacksize);
+		return it == registry->histograms.end() ? Histogram() : it->second;
+	}
+
+	// 百分位所在桶的上界(KB)
+	static size_t BucketPercentile(const StackWatermark::Histogram &histogram, double percent)
+	{
+		uint64_t target = (uint64_t)(histogram.count * percent);
+		uint64_t sum = 0;
+		for (size_t i = 0; i < StackWatermark::kBucketCount; i++)
+		{
+			sum += histogram.buckets[i];
+			if (sum > target || sum == histogram.count)
+			{
+				return (size_t)1 << i;
+			}
+		}
+		return (size_t)1 << (StackWatermark::kBucketCount - 1);
+	}
+
+	void StackWatermark::Dump(std::ostream &os)
+	{
+		std::map<size_t, Histogram> histograms;
+		{
+			WatermarkRegistry *registry = WatermarkRegistry::GetInstance();
+			std::lock_guard<std::mutex> lock(registry->mutex);
+			histograms = registry->histograms;
+		}
+
+		for (auto &it : histograms)
+		{
+			const Histogram &histogram = it.second;
+			os << "StackWatermark: stacksize=" << it.first
+			   << " fibers=" << histogram.count
+			   << " p50<=" << BucketPercentile(histogram, 0.5) << "KB"
+			   << " p99<=" << BucketPercentile(histogram, 0.99) << "KB"
+			   << " max=" << histogram.max_used << std::endl;
+			for (size_t i = 0; i < kBucketCount; i++)
+			{
+				if (histogram.buckets[i])
+				{
+					os << "  <=" << ((size_t)1 << i) << "KB: " << histogram.buckets[i] << std::endl;
+				}
+			}
+		}
+	}
+
+	SharedStack::SharedStack(size_t size, StackAllocator::Mode mode)
+		: m_mode(mode)
+	{
+		m_size = StackAllocator::RoundUp(size);
+		m_stack = SystemAlloc(m_size, m_mode);
+		if (!m_stack)
+		{
+			throw std::bad_alloc();
+		}
+	}
+
+	SharedStack::~SharedStack()
+	{
+		SystemFree(m_stack, m_size, m_mode);
+	}
+
+	SharedStackPool::SharedStackPool(size_t count, size_t stacksize, StackAllocator::Mode mode)
+	{
+		m_stacks.reserve(count ? count : 1);
+		for (size_t i = 0; i < (count ? count : 1); i++)
+		{
+			m_stacks.push_back(std::make_shared<SharedStack>(stacksize, mode));
+		}
+	}
+
+	SharedStack::ptr SharedStackPool::next()
+	{
+		size_t idx = m_next.fetch_add(1, std::memory_order_relaxed);
+		return m_stacks[idx % m_stacks.size()];
+	}
+
+} // namespace corlib
@@ -0,0 +1,150 @@
+#ifndef _STACK_ALLOCATOR_H_
+#define _STACK_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+namespace corlib
+{
+
+	// 协程栈分配器
+	// 栈大小按2的幂划分为若干级别(16K ~ 1M), 每个线程为每个级别缓存少量空闲栈,
+	// 线程缓存满了或空了再与全局池批量交换, 超过最大级别的栈直接向系统申请/释放
+	class StackAllocator
+	{
+	public:
+		// 栈的来源
+		enum Mode
+		{
+			// malloc/free
+			MALLOC = 0,
+			// mmap预留地址空间, 栈底下方有一个PROT_NONE保护页, 物理页在被访问时才由内核提交
+			MMAP = 1,
+			MODE_COUNT
+		};
+
+		// 命中/未命中统计
+		struct Stats
+		{
+			uint64_t local_hits = 0;  // 从线程缓存分配
+			uint64_t global_hits = 0; // 从全局池分配
+			uint64_t misses = 0;	  // 缓存未命中 -> 向系统申请
+			uint64_t local_frees = 0; // 释放到线程缓存
+			uint64_t global_frees = 0; // 线程缓存满 -> 释放到全局池
+			uint64_t releases = 0;	  // 全局池满或超大栈 -> 还给系统
+		};
+
+		// 最小/最大的缓存级别
+		static const size_t kMinClassSize = 16 * 1024;
+		static const size_t kMaxClassSize = 1024 * 1024;
+		static const size_t kClassCount = 7;
+
+		// 将栈大小向上取整到所属级别, 超过最大级别的按页对齐
+		static size_t RoundUp(size_t size);
+
+		// 分配/释放栈, size必须是RoundUp之后的值, 释放时的mode必须与分配时一致
+		static void *Alloc(size_t size, Mode mode = MALLOC);
+		static void Dealloc(void *stack, size_t size, Mode mode = MALLOC);
+
+		// 设置当前线程所在的NUMA节点(-1表示不指定) -> 线程缓存只与该节点的全局池交换栈
+		// 新申请的栈由线程的内存策略决定放在哪个节点(见Numa::SetPreferredNode)
+		static void SetThreadNode(int node);
+
+		// 系统页大小
+		static size_t PageSize();
+
+		// 设置每个级别线程缓存/全局池最多保留的栈个数
+		// MMAP模式: 线程缓存中的栈保留曾经提交的物理页(深调用之后的峰值), 移入全局池时归还到只剩栈顶一页
+		static void SetLimits(size_t per_thread, size_t global);
+
+		// 获取统计信息
+		static Stats GetStats();
+		static void DumpStats(std::ostream &os);
+	};
+
+	// 协程栈高水位线统计
+	// 开启后协程栈在分配时用固定的填充值涂满, 协程结束时从栈底向上找到第一个被改写的字节,
+	// 得到栈曾经使用过的最大深度, 并按栈大小记录到进程级的直方图中, 用于依据数据调小栈大小
+	// 注意: 涂栈会提交整个栈的物理内存(MMAP模式的延迟提交失效), 只建议在诊断时开启
+	class StackWatermark
+	{
+	public:
+		// 直方图的桶: 第i个桶统计使用量在(2^(i-1), 2^i] KB之间的次数, 第0个桶为<=1KB
+		static const size_t kBucketCount = 12;
+
+		struct Histogram
+		{
+			uint64_t count = 0;
+			size_t max_used = 0;
+			uint64_t buckets[kBucketCount] = {};
+		};
+
+		static void SetEnabled(bool enabled);
+		static bool IsEnabled();
+
+		// 用填充值涂满栈中[stack, stack + size)这一段
+		static void Paint(void *stack, size_t size);
+		// 返回大小为size的栈从栈顶开始被使用过的最大深度
+		static size_t Measure(const void *stack, size_t size);
+
+		// 记录一次栈使用量
+		static void Record(size_t stacksize, size_t used);
+		// 获取某个栈大小的直方图
+		static Histogram GetHistogram(size_t stacksize);
+		// 输出所有栈大小的直方图及p50/p99/max
+		static void Dump(std::ostream &os);
+	};
+
+	class Fiber;
+
+	// 共享栈(参考libco的co_alloc_sharestack)
+	// 多个协程轮流在同一块栈上运行, 只有当另一个协程要使用这块栈时,
+	// 才把原来协程栈上活跃的部分拷贝到它自己的缓冲区, 挂起的协程只占用实际使用的栈大小
+	class SharedStack
+	{
+		friend class Fiber;
+	public:
+		typedef std::shared_ptr<SharedStack> ptr;
+
+		SharedStack(size_t size, StackAllocator::Mode mode = StackAllocator::MMAP);
+		~SharedStack();
+
+		char *getBottom() const { return (char *)m_stack; }
+		char *getTop() const { return (char *)m_stack + m_size; }
+		size_t getSize() const { return m_size; }
+
+	private:
+		void *m_stack = nullptr;
+		size_t m_size = 0;
+		StackAllocator::Mode m_mode;
+		// 同一时刻只允许一个协程在栈上运行
+		std::mutex m_mutex;
+		// 栈上当前保存着哪个协程的现场
+		std::atomic<Fiber *> m_occupant = {nullptr};
+	};
+
+	// 共享栈池 -> 轮流把栈分给新创建的协程
+	class SharedStackPool
+	{
+	public:
+		typedef std::shared_ptr<SharedStackPool> ptr;
+
+		SharedStackPool(size_t count, size_t stacksize, StackAllocator::Mode mode = StackAllocator::MMAP);
+
+		SharedStack::ptr next();
+		size_t getCount() const { return m_stacks.size(); }
+		size_t getStackSize() const { return m_stacks.empty() ? 0 : m_stacks[0]->getSize(); }
+
+	private:
+		std::vector<SharedStack::ptr> m_stacks;
+		std::atomic<size_t> m_next = {0};
+	};
+
+} // namespace corlib
+
+#endif
@@ -0,0 +1,93 @@
+#include "task.h"
+
+#include <stdexcept>
+
+namespace corlib
+{
+
+	// 恢复协程的回调 -> 在调度器的回调协程上执行
+	static std::function<void()> ResumeCb(std::coroutine_handle<> handle)
+	{
+		return [handle]()
+		{ handle.resume(); };
+	}
+
+	// co_spawn的外壳协程: 创建后挂起, 结束时不挂起 -> 协程帧自动释放
+	struct DetachedTask
+	{
+		struct promise_type
+		{
+			DetachedTask get_return_object()
+			{
+				return DetachedTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception()
+			{
+				std::cerr << "co_spawn: unhandled exception in task" << std::endl;
+				std::terminate();
+			}
+		};
+
+		std::coroutine_handle<promise_type> m_handle;
+	};
+
+	static DetachedTask RunDetached(Task<void> task)
+	{
+		co_await std::move(task);
+	}
+
+	void co_spawn(Task<void> task, Scheduler *scheduler, int thread)
+	{
+		if (!scheduler)
+		{
+			scheduler = Scheduler::GetThis();
+		}
+		if (!scheduler)
+		{
+			throw std::logic_error("co_spawn: no scheduler on this thread");
+		}
+		DetachedTask detached = RunDetached(std::move(task));
+		scheduler->scheduleLock(ResumeCb(detached.m_handle), thread);
+	}
+
+	bool EventAwaiter::await_suspend(std::coroutine_handle<> handle)
+	{
+		IOManager *iom = IOManager::GetThis();
+		if (!iom)
+		{
+			throw std::logic_error("waitEvent: no IOManager on this thread");
+		}
+		// 注册成功后事件可能立刻在其他线程触发并恢复协程 -> 之后不能再访问this
+		int rt = iom->addEvent(m_fd, m_event, ResumeCb(handle));
+		if (rt)
+		{
+			m_result = rt;
+			return false;
+		}
+		return true;
+	}
+
+	void SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+	{
+		IOManager *iom = IOManager::GetThis();
+		if (!iom)
+		{
+			throw std::logic_error("sleepFor: no IOManager on this thread");
+		}
+		iom->addTimer(m_ms, ResumeCb(handle));
+	}
+
+	void ScheduleAwaiter::await_suspend(std::coroutine_handle<> handle)
+	{
+		Scheduler *scheduler = m_scheduler ? m_scheduler : Scheduler::GetThis();
+		if (!scheduler)
+		{
+			throw std::logic_error("switchTo: no scheduler on this thread");
+		}
+		scheduler->scheduleLock(ResumeCb(handle), m_thread);
+	}
+
+} // namespace corlib
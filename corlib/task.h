@@ -0,0 +1,237 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+#include "ioscheduler.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace corlib
+{
+
+	// 基于C++20 co_await的无栈协程任务
+	// 协程帧只保存跨越co_await的局部变量(通常几百字节), 挂起时不占用任何协程栈;
+	// 被恢复时借用调度器当前回调协程的栈运行, 因此可以和已有的Fiber混合调度
+	// 注意: Task中不要调用会被hook挂起的阻塞接口(它会挂起借来的Fiber), 应使用非阻塞fd + co_await waitEvent
+	template <class T = void>
+	class Task;
+
+	namespace detail
+	{
+
+		struct TaskPromiseBase
+		{
+			// co_await该任务的协程 -> 任务结束时切回
+			std::coroutine_handle<> m_continuation;
+			std::exception_ptr m_exception;
+
+			// 结束时对称转移到等待者, 不额外占用调用栈
+			struct FinalAwaiter
+			{
+				bool await_ready() noexcept { return false; }
+
+				template <class Promise>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+				{
+					std::coroutine_handle<> continuation = h.promise().m_continuation;
+					return continuation ? continuation : std::noop_coroutine();
+				}
+
+				void await_resume() noexcept {}
+			};
+
+			// 惰性启动 -> 被co_await或co_spawn时才开始执行
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			FinalAwaiter final_suspend() noexcept { return {}; }
+			void unhandled_exception() { m_exception = std::current_exception(); }
+		};
+
+		template <class T>
+		struct TaskPromise : public TaskPromiseBase
+		{
+			std::optional<T> m_value;
+
+			Task<T> get_return_object();
+
+			template <class U>
+			void return_value(U &&value) { m_value.emplace(std::forward<U>(value)); }
+
+			T result()
+			{
+				if (m_exception)
+				{
+					std::rethrow_exception(m_exception);
+				}
+				return std::move(*m_value);
+			}
+		};
+
+		template <>
+		struct TaskPromise<void> : public TaskPromiseBase
+		{
+			Task<void> get_return_object();
+
+			void return_void() {}
+
+			void result()
+			{
+				if (m_exception)
+				{
+					std::rethrow_exception(m_exception);
+				}
+			}
+		};
+
+	} // namespace detail
+
+	template <class T>
+	class Task
+	{
+	public:
+		typedef detail::TaskPromise<T> promise_type;
+		typedef std::coroutine_handle<promise_type> handle_type;
+
+		Task() = default;
+		explicit Task(handle_type handle) : m_handle(handle) {}
+		Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+		Task &operator=(Task &&other) noexcept
+		{
+			if (this != &other)
+			{
+				if (m_handle)
+				{
+					m_handle.destroy();
+				}
+				m_handle = std::exchange(other.m_handle, nullptr);
+			}
+			return *this;
+		}
+		Task(const Task &) = delete;
+		Task &operator=(const Task &) = delete;
+
+		~Task()
+		{
+			if (m_handle)
+			{
+				m_handle.destroy();
+			}
+		}
+
+		bool done() const { return !m_handle || m_handle.done(); }
+
+		// co_await一个Task -> 启动它, 结束后恢复等待者并取得返回值(或重新抛出异常)
+		auto operator co_await() &&noexcept
+		{
+			struct Awaiter
+			{
+				handle_type m_handle;
+
+				bool await_ready() noexcept { return !m_handle || m_handle.done(); }
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+				{
+					m_handle.promise().m_continuation = continuation;
+					return m_handle;
+				}
+
+				T await_resume() { return m_handle.promise().result(); }
+			};
+			return Awaiter{m_handle};
+		}
+
+		auto operator co_await() &noexcept
+		{
+			return std::move(*this).operator co_await();
+		}
+
+	private:
+		handle_type m_handle = nullptr;
+	};
+
+	namespace detail
+	{
+
+		template <class T>
+		inline Task<T> TaskPromise<T>::get_return_object()
+		{
+			return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+		}
+
+		inline Task<void> TaskPromise<void>::get_return_object()
+		{
+			return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+		}
+
+	} // namespace detail
+
+	// 在调度器上启动一个Task, 不等待其结果, 任务结束后协程帧自动释放
+	// scheduler为空则使用当前线程的调度器(也没有则抛出std::logic_error); 任务中未捕获的异常会终止进程
+	void co_spawn(Task<void> task, Scheduler *scheduler = nullptr, int thread = -1);
+
+	// 等待fd上的事件就绪 -> 挂起期间事件注册在当前线程的IOManager上, 当前线程没有IOManager时抛出std::logic_error
+	// 返回0表示事件就绪(或被cancelEvent取消), -1表示注册失败(如事件已被注册)
+	class EventAwaiter
+	{
+	public:
+		EventAwaiter(int fd, IOManager::Event event) : m_fd(fd), m_event(event) {}
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> handle);
+		int await_resume() const noexcept { return m_result; }
+
+	private:
+		int m_fd;
+		IOManager::Event m_event;
+		int m_result = 0;
+	};
+
+	// 挂起ms毫秒 -> 使用当前线程IOManager的定时器, 当前线程没有IOManager时抛出std::logic_error
+	class SleepAwaiter
+	{
+	public:
+		explicit SleepAwaiter(uint64_t ms) : m_ms(ms) {}
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle);
+		void await_resume() const noexcept {}
+
+	private:
+		uint64_t m_ms;
+	};
+
+	// 把协程的后续部分作为任务投递到scheduler上(可指定线程), 也可用于让出当前线程
+	class ScheduleAwaiter
+	{
+	public:
+		ScheduleAwaiter(Scheduler *scheduler, int thread) : m_scheduler(scheduler), m_thread(thread) {}
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle);
+		void await_resume() const noexcept {}
+
+	private:
+		Scheduler *m_scheduler;
+		int m_thread;
+	};
+
+	inline EventAwaiter waitEvent(int fd, IOManager::Event event)
+	{
+		return EventAwaiter(fd, event);
+	}
+
+	inline SleepAwaiter sleepFor(uint64_t ms)
+	{
+		return SleepAwaiter(ms);
+	}
+
+	// scheduler为空表示当前线程的调度器(也没有则抛出std::logic_error), thread为-1表示任意线程
+	inline ScheduleAwaiter switchTo(Scheduler *scheduler = nullptr, int thread = -1)
+	{
+		return ScheduleAwaiter(scheduler, thread);
+	}
+
+} // namespace corlib
+
+#endif
@@ -1,5 +1,7 @@
 #include "timer.h"
 
+#include <algorithm>
+
 namespace corlib
 {
 
@@ -107,9 +109,10 @@ namespace corlib
     }
 
     // 添加定时器
-    std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+    std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring, int priority)
     {
         std::shared_ptr<Timer> timer(new Timer(ms, cb, recurring, this));
+        timer->m_priority = priority;
         addTimer(timer);
         return timer;
     }
@@ -125,9 +128,9 @@ namespace corlib
     }
 
     // 添加条件定时器
-    std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring)
+    std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring, int priority)
     {
-        return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+        return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, priority);
     }
 
     // 获取下一个定时器的超时时间
@@ -161,6 +164,11 @@ namespace corlib
 
     // 列出所有已过期的定时器回调函数
     void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs)
+    {
+        listExpiredCb(&cbs, 1);
+    }
+
+    void TimerManager::listExpiredCb(std::vector<std::function<void()>> *lanes, int count)
     {
         auto now = std::chrono::system_clock::now();
 
@@ -174,7 +182,7 @@ namespace corlib
             std::shared_ptr<Timer> temp = *m_timers.begin();
             m_timers.erase(m_timers.begin());
 
-            cbs.push_back(temp->m_cb);
+            lanes[std::max(0, std::min(temp->m_priority, count - 1))].push_back(temp->m_cb);
 
             if (temp->m_recurring)
             {
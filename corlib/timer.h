@@ -38,6 +38,8 @@ private:
     std::function<void()> m_cb;
     // 管理此timer的管理器
     TimerManager* m_manager = nullptr;
+    // 回调的调度优先级, 由使用定时器的调度器解释(IOManager中为Scheduler::Priority)
+    int m_priority = 0;
 
 private:
     // 实现最小堆的比较函数
@@ -55,16 +57,18 @@ public:
     virtual ~TimerManager();
 
     // 添加timer
-    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false, int priority = 0);
 
     // 添加条件timer
-    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false, int priority = 0);
 
     // 拿到堆中最近的超时时间
     uint64_t getNextTimer();
 
     // 取出所有超时定时器的回调函数
     void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    // 按优先级取出: 优先级为p的回调放入lanes[p](超出count的放入最后一个)
+    void listExpiredCb(std::vector<std::function<void()>>* lanes, int count);
 
     // 堆中是否有timer
     bool hasTimer();
@@ -0,0 +1,189 @@
+#ifndef _WORK_STEALING_QUEUE_H_
+#define _WORK_STEALING_QUEUE_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+namespace corlib
+{
+
+	// Chase-Lev工作窃取双端队列(按 Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models" 的C11版本)
+	// 只有所属线程可以push/pop(在底部, 后进先出), 其他线程通过steal从顶部窃取(先进先出)
+	// 元素为指针, 空队列返回nullptr; 容量不足时自动翻倍, 窃取方可能仍在读取旧的数组 ->
+	// 所属线程pop发现队列为空且没有正在进行的窃取时才释放它们
+	template <class T>
+	class WorkStealingQueue
+	{
+	public:
+		explicit WorkStealingQueue(size_t capacity = 256)
+		{
+			size_t size = 1;
+			while (size < capacity)
+			{
+				size <<= 1;
+			}
+			m_array.store(new Array(size), std::memory_order_relaxed);
+		}
+
+		~WorkStealingQueue()
+		{
+			delete m_array.load(std::memory_order_relaxed);
+			for (Array *array : m_retired)
+			{
+				delete array;
+			}
+		}
+
+		WorkStealingQueue(const WorkStealingQueue &) = delete;
+		WorkStealingQueue &operator=(const WorkStealingQueue &) = delete;
+
+		// 所属线程在底部压入
+		void push(T *item)
+		{
+			int64_t b = m_bottom.load(std::memory_order_relaxed);
+			int64_t t = m_top.load(std::memory_order_acquire);
+			Array *array = m_array.load(std::memory_order_relaxed);
+			if (b - t > (int64_t)array->size - 1)
+			{
+				array = replace(array, array->size * 2, t, b);
+			}
+			array->put(b, item);
+			std::atomic_thread_fence(std::memory_order_release);
+			m_bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		// 所属线程从底部取出最近压入的元素
+		T *pop()
+		{
+			int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+			Array *array = m_array.load(std::memory_order_relaxed);
+			m_bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = m_top.load(std::memory_order_relaxed);
+
+			T *item = nullptr;
+			if (t <= b)
+			{
+				item = array->get(b);
+				if (t == b)
+				{
+					// 最后一个元素 -> 与窃取方竞争
+					if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					{
+						item = nullptr;
+					}
+					m_bottom.store(b + 1, std::memory_order_relaxed);
+				}
+			}
+			else
+			{
+				m_bottom.store(b + 1, std::memory_order_relaxed);
+				// 队列为空 -> 释放扩容时换下的数组
+				if (!m_retired.empty())
+				{
+					reclaimRetired();
+				}
+			}
+			return item;
+		}
+
+		// 其他线程从顶部窃取最早压入的元素, 队列为空或与其他线程竞争失败时返回nullptr
+		T *steal()
+		{
+			// 在读取m_array之前登记 -> 所属线程不会释放可能被读取的数组(见reclaimRetired)
+			m_stealers.fetch_add(1, std::memory_order_relaxed);
+			int64_t t = m_top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = m_bottom.load(std::memory_order_acquire);
+			T *item = nullptr;
+			if (t < b)
+			{
+				Array *array = m_array.load(std::memory_order_acquire);
+				item = array->get(t);
+				if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					item = nullptr;
+				}
+			}
+			m_stealers.fetch_sub(1, std::memory_order_release);
+			return item;
+		}
+
+		// 元素个数的估计值
+		size_t size() const
+		{
+			int64_t b = m_bottom.load(std::memory_order_relaxed);
+			int64_t t = m_top.load(std::memory_order_relaxed);
+			return b > t ? (size_t)(b - t) : 0;
+		}
+
+		bool empty() const { return size() == 0; }
+
+		// 所属线程重新分配同样大小的数组 -> 新数组从所属线程当前的内存策略(NUMA节点)分配
+		void relocate()
+		{
+			int64_t b = m_bottom.load(std::memory_order_relaxed);
+			int64_t t = m_top.load(std::memory_order_acquire);
+			Array *array = m_array.load(std::memory_order_relaxed);
+			replace(array, array->size, t, b);
+		}
+
+	private:
+		// 环形数组, 大小为2的幂
+		struct Array
+		{
+			size_t size;
+			size_t mask;
+			std::atomic<T *> *items;
+
+			explicit Array(size_t n) : size(n), mask(n - 1), items(new std::atomic<T *>[n]) {}
+			~Array() { delete[] items; }
+
+			T *get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+			void put(int64_t i, T *item) { items[i & mask].store(item, std::memory_order_relaxed); }
+		};
+
+		// 换成大小为size的新数组, 窃取方可能仍在读取旧数组 -> 旧数组只是换下, 之后由reclaimRetired释放
+		Array *replace(Array *array, size_t size, int64_t t, int64_t b)
+		{
+			Array *fresh = new Array(size);
+			for (int64_t i = t; i < b; i++)
+			{
+				fresh->put(i, array->get(i));
+			}
+			m_retired.push_back(array);
+			m_array.store(fresh, std::memory_order_release);
+			return fresh;
+		}
+
+		// 所属线程释放换下的数组
+		// 与steal配对的两个seq_cst栅栏: 看到计数为0时, 之后登记的窃取方一定读到新数组; 否则计数不为0, 等下次再释放
+		void reclaimRetired()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_stealers.load(std::memory_order_acquire) != 0)
+			{
+				return;
+			}
+			for (Array *array : m_retired)
+			{
+				delete array;
+			}
+			m_retired.clear();
+		}
+
+	private:
+		// 顶部和底部放在不同的缓存行, 避免窃取方和所属线程互相干扰
+		alignas(64) std::atomic<int64_t> m_top = {0};
+		alignas(64) std::atomic<int64_t> m_bottom = {0};
+		alignas(64) std::atomic<Array *> m_array;
+		// 扩容后换下的数组, 只由所属线程访问
+		std::vector<Array *> m_retired;
+		// 正在进行的窃取数
+		std::atomic<int> m_stealers = {0};
+	};
+
+} // namespace corlib
+
+#endif